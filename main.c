@@ -1,9 +1,15 @@
 #include "wlr/util/box.h"
 #include "xdg-shell-protocol.h"
 #include <assert.h>
+#include <ctype.h>
+#include <fcntl.h>
 #include <getopt.h>
+#include <inttypes.h>
+#include <libgen.h>
 #include <pwd.h>
 #include <regex.h>
+#include <signal.h>
+#include <spawn.h>
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
@@ -11,7 +17,12 @@
 #include <stdlib.h>
 #include <string.h>
 #include <strings.h>
+#include <sys/inotify.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/timerfd.h>
 #include <sys/types.h>
+#include <sys/wait.h>
 #include <time.h>
 #include <unistd.h>
 #include <wayland-server-core.h>
@@ -21,19 +32,34 @@
 #include <wlr/render/swapchain.h>
 #include <wlr/render/wlr_renderer.h>
 #include <wlr/types/wlr_compositor.h>
+#include <wlr/types/wlr_content_type_v1.h>
 #include <wlr/types/wlr_cursor.h>
 #include <wlr/types/wlr_data_device.h>
+#include <wlr/types/wlr_drm.h>
+#include <wlr/types/wlr_export_dmabuf_v1.h>
+#include <wlr/types/wlr_ext_foreign_toplevel_list_v1.h>
+#include <wlr/types/wlr_ext_image_capture_source_v1.h>
+#include <wlr/types/wlr_ext_image_copy_capture_v1.h>
 #include <wlr/types/wlr_input_device.h>
 #include <wlr/types/wlr_keyboard.h>
+#include <wlr/types/wlr_layer_shell_v1.h>
+#include <wlr/types/wlr_linux_dmabuf_v1.h>
+#include <wlr/types/wlr_linux_drm_syncobj_v1.h>
 #include <wlr/types/wlr_output.h>
 #include <wlr/types/wlr_output_layer.h>
 #include <wlr/types/wlr_output_layout.h>
 #include <wlr/types/wlr_output_management_v1.h>
 #include <wlr/types/wlr_output_swapchain_manager.h>
+#include <wlr/types/wlr_pointer.h>
+#include <wlr/types/wlr_presentation_time.h>
+#include <wlr/types/wlr_relative_pointer_v1.h>
 #include <wlr/types/wlr_scene.h>
+#include <wlr/types/wlr_screencopy_v1.h>
 #include <wlr/types/wlr_seat.h>
 #include <wlr/types/wlr_subcompositor.h>
+#include <wlr/types/wlr_tearing_control_v1.h>
 #include <wlr/types/wlr_xcursor_manager.h>
+#include <wlr/types/wlr_xdg_activation_v1.h>
 #include <wlr/types/wlr_xdg_output_v1.h>
 #include <wlr/types/wlr_xdg_shell.h>
 #include <wlr/util/log.h>
@@ -41,9 +67,22 @@
 #include <xkbcommon/xkbcommon-keysyms.h>
 #include <xkbcommon/xkbcommon.h>
 
+extern char **environ;
+
 #define TODO(msg) (void)
+#define ARRAY_SIZE(arr) (sizeof(arr) / sizeof((arr)[0]))
 
 struct output *output_first(bool single);
+bool output_usable(struct output *output);
+void output_update_scanout(struct output *output);
+void output_update_vrr(struct output *output);
+void output_set_color(struct output *output, const float color[static 4]);
+void input_motion_flush(void);
+struct key;
+void command_resolve(struct key *key);
+struct layer;
+void layer_popup_create(struct layer *layer, struct wlr_xdg_popup *xdg_popup,
+			struct wlr_scene_tree *parent);
 
 /// type
 
@@ -53,14 +92,17 @@ struct server {
 	struct wlr_session *session;
 	struct wlr_renderer *renderer;
 	struct wlr_allocator *allocator;
+	struct wlr_linux_dmabuf_v1 *linux_dmabuf; // NULL without dmabuf
 
 	struct wl_list outputs; // output.link
 	struct wl_listener new_output;
+	struct wl_event_source *frame_idle; // batch output.frame_pending
 
 	struct wlr_output_layout *output_layout;
 	struct wl_listener output_layout_add;
 	struct wl_listener output_layout_change;
 	struct wl_listener output_layout_destroy; // TODO
+	struct wl_event_source *layout_idle; // see output_layout_arrange
 
 	struct wlr_scene *scene;
 	struct wlr_scene_output_layout *scene_output_layout;
@@ -75,23 +117,60 @@ struct server {
 	struct wlr_scene_tree *layer_monocle; // main
 	struct wlr_scene_tree *layer_top;     // fullscreen shell?
 	struct wlr_scene_tree *layer_overlay;
+	struct wlr_layer_shell_v1 *layer_shell;
+	struct wl_listener new_layer_surface;
+	struct layer *exclusive_layer; // keeps the keyboard while mapped
 
 	struct wl_list clients; // client.link
+	struct wl_event_source *txn_timer;
+	size_t txn_pending; // clients yet to ack
 	struct wlr_xdg_shell *xdg_shell;
 	struct wl_listener new_xdg_toplevel;
 	struct wl_listener new_xdg_popup;
 
 	struct wl_listener xdg_toplevel_decoration;
+
+	struct wlr_content_type_manager_v1 *content_type_manager;
+	struct wlr_tearing_control_manager_v1 *tearing_control;
+
+	struct wlr_ext_foreign_toplevel_list_v1 *foreign_toplevel_list;
+	struct wlr_xdg_activation_v1 *xdg_activation;
+	struct wl_listener request_activate;
+	struct wl_listener new_token;
+	struct wl_list jumps; // jump.link
+
+	struct wl_list children; // child.link
+
+	struct wlr_seat *seat;
+	struct wl_listener new_input;
+	struct wl_listener request_set_cursor;
+	struct wl_listener request_set_selection;
+	struct wl_list keyboards; // keyboard.link
+	struct client *focus;	  // shown somewhere, or NULL
+
+	struct wlr_cursor *cursor;
+	struct wlr_xcursor_manager *xcursor_manager;
+	struct wl_listener cursor_motion;
+	struct wl_listener cursor_motion_absolute;
+	struct wl_listener cursor_button;
+	struct wl_listener cursor_axis;
+	struct wl_listener cursor_frame;
+	struct wlr_relative_pointer_manager_v1 *relative_pointer_manager;
+	bool motion_pending;  // see input_motion_flush
+	uint32_t motion_time; // of the last folded motion
 } server;
 
 struct output {
 	struct wlr_output *wlr_output;
 	struct client *current_client;
 	struct wlr_box output_box;
-	struct wlr_scene_tree *scene_tree;
-	struct wlr_scene_rect *scene_border[4]; // left, right, top, bottom
-
-	// int border_padding = output->wlr_output->scale;
+	struct wlr_box usable_box; // output_box minus exclusive zones
+	struct wlr_scene_tree *border;		// below current_client
+	struct wlr_scene_rect *border_rects[4]; // see output_set_border
+	struct wlr_box border_box;		// empty when collapsed
+	bool border_opaque;
+	bool covered;	 // current_client fills output_box
+	bool vrr_failed; // until the client or the mode changes
 
 	// both would be destroyed when output is removed from output_layout
 	// struct wlr_output_layout_output *output_layout_output;
@@ -99,11 +178,32 @@ struct output {
 
 	struct wl_listener commit;
 	struct wl_listener frame;
+	struct wl_listener present;
 	struct wl_listener request_state;
 	struct wl_listener destroy;
 
 	struct wl_listener output_layout_output_destroy;
 
+	// children of server.layer_*, by zwlr_layer_shell_v1_layer
+	struct wlr_scene_tree *layers[4];
+	struct wl_list layer_surfaces; // layer.link
+
+	bool frame_pending; // wait for output_frame_idle
+
+	// render as late as possible, see output_frame_notify
+	int pace_fd; // timerfd, -1 if unused
+	struct wl_event_source *pace_source;
+	uint64_t render_ns[16]; // recent build + commit time
+	size_t render_idx;
+
+	// from the last present event, see output_next_vblank
+	uint64_t present_ns; // CLOCK_MONOTONIC, 0 if never
+	uint64_t refresh_ns; // 0 if unknown or variable
+
+	uint64_t frames_rendered;
+	uint64_t frames_skipped; // scene had no damage
+	uint64_t frames_scanout; // client buffer went to the output as is
+
 	struct wl_list link; // server.outputs
 };
 
@@ -113,6 +213,16 @@ struct client {
 
 	struct output *output;
 
+	uint32_t txn_serial;		 // configure to wait for, or 0
+	struct wlr_scene_tree *snapshot; // old buffers during transaction
+
+	uint64_t frames;  // frame done while shown
+	uint64_t commits; // including the ones while hidden
+
+	struct wlr_ext_foreign_toplevel_handle_v1 *foreign_toplevel;
+	struct wl_listener set_title;
+	struct wl_listener set_app_id;
+
 	struct wl_listener client_commit;
 	struct wl_listener commit;
 	struct wl_listener map;
@@ -123,11 +233,71 @@ struct client {
 	struct wl_list link; // server.clients
 };
 
+struct layer {
+	struct wlr_layer_surface_v1 *layer_surface;
+	struct wlr_scene_layer_surface_v1 *scene;
+	struct output *output;
+
+	struct wl_listener commit;
+	struct wl_listener map;
+	struct wl_listener unmap;
+	struct wl_listener new_popup;
+	struct wl_listener destroy;
+
+	struct wl_list link; // output.layer_surfaces
+};
+
+struct layer_popup {
+	struct wlr_xdg_popup *xdg_popup;
+	struct layer *layer; // of the root, nested popups too
+
+	struct wl_listener commit;
+	struct wl_listener new_popup;
+	struct wl_listener destroy;
+};
+
+struct keyboard {
+	struct wlr_keyboard *wlr_keyboard;
+	// pressed keys that ran a keybinding, their release is dropped
+	uint32_t consumed[WLR_KEYBOARD_KEYS_CAP];
+	size_t consumed_len;
+
+	struct wl_listener modifiers;
+	struct wl_listener key;
+	struct wl_listener destroy;
+
+	struct wl_list link; // server.keyboards
+};
+
 struct key {
 	uint32_t modifiers;
 	xkb_keysym_t keysym;
-	char *command;	     // need free
-	struct wl_list link; // config.keybings
+	char *command;			// need free
+	void (*run)(const char *arg);	// see command_resolve
+	const char *arg;		// into command
+	bool stale;			// not seen by the running reload
+	struct wl_list link;		// config.keybings
+};
+
+// adaptive sync for the current client of an output, see client_wants_vrr
+enum vrr_mode {
+	VRR_OFF,
+	VRR_FULLSCREEN, // any fullscreen client
+	VRR_CONTENT,	// fullscreen games and videos
+};
+
+const char *vrr_names[] = {
+	[VRR_OFF] = "off",
+	[VRR_FULLSCREEN] = "fullscreen",
+	[VRR_CONTENT] = "content",
+};
+
+// open addressing with linear probing, never shrinks
+struct keymap {
+	struct key **slots;
+	size_t size; // power of 2
+	size_t count;
+	uint64_t masks[4]; // bitmap of used modifiers, 1 << WLR_MODIFIER_COUNT
 };
 
 struct config {
@@ -135,9 +305,345 @@ struct config {
 	float color_fb[4];	   // focus border
 	float color_nb[4];	   // normal border
 	struct wl_list keybings;   // key.link
+	struct keymap keymap;	   // lookup of keybings
 	struct wl_array start_cmd; // char *ptr
+	int frame_margin;	   // us before vblank, 0 to render on frame
+	enum vrr_mode vrr;	   // -a
+	bool debug;		   // -d in wlessrc, for the cache
+
+	// reload
+	char *path; // wlessrc
+	int argc;
+	char **argv;
+	bool reloading; // start_cmd only runs once
 } config;
 
+/// keymap
+
+uint32_t keymap_hash(uint32_t modifiers, xkb_keysym_t keysym) {
+	uint32_t hash = keysym * 0x9e3779b1u;
+	hash ^= modifiers * 0x85ebca6bu;
+	return hash ^ hash >> 15;
+}
+
+bool keymap_has_modifiers(uint32_t modifiers) {
+	uint8_t m = modifiers & 0xff;
+	return config.keymap.masks[m >> 6] & UINT64_C(1) << (m & 63);
+}
+
+// hot path of every keypress
+struct key *keymap_lookup(uint32_t modifiers, xkb_keysym_t keysym) {
+	struct keymap *keymap = &config.keymap;
+	if (!keymap_has_modifiers(modifiers)) {
+		return NULL;
+	}
+	size_t mask = keymap->size - 1;
+	size_t i = keymap_hash(modifiers, keysym) & mask;
+	for (struct key *key; (key = keymap->slots[i]); i = (i + 1) & mask) {
+		if (key->modifiers == modifiers && key->keysym == keysym) {
+			return key;
+		}
+	}
+	return NULL;
+}
+
+void keymap_place(struct keymap *keymap, struct key *key) {
+	size_t mask = keymap->size - 1;
+	size_t i = keymap_hash(key->modifiers, key->keysym) & mask;
+	while (keymap->slots[i]) {
+		i = (i + 1) & mask;
+	}
+	keymap->slots[i] = key;
+}
+
+// caller should check keymap_lookup first
+void keymap_insert(struct key *key) {
+	struct keymap *keymap = &config.keymap;
+
+	// keep load factor under 1/2
+	if ((keymap->count + 1) * 2 > keymap->size) {
+		struct key **old_slots = keymap->slots;
+		size_t old_size = keymap->size;
+
+		keymap->size = old_size ? old_size * 2 : 16;
+		keymap->slots = calloc(keymap->size, sizeof(*keymap->slots));
+		for (size_t i = 0; i < old_size; i++) {
+			if (old_slots[i]) {
+				keymap_place(keymap, old_slots[i]);
+			}
+		}
+		free(old_slots);
+	}
+
+	keymap_place(keymap, key);
+	keymap->count++;
+
+	uint8_t m = key->modifiers & 0xff;
+	keymap->masks[m >> 6] |= UINT64_C(1) << (m & 63);
+}
+
+// backward shift, no tombstones
+void keymap_remove(struct key *key) {
+	struct keymap *keymap = &config.keymap;
+	size_t mask = keymap->size - 1;
+	size_t i = keymap_hash(key->modifiers, key->keysym) & mask;
+	while (keymap->slots[i] != key) {
+		assert(keymap->slots[i]);
+		i = (i + 1) & mask;
+	}
+	keymap->slots[i] = NULL;
+	keymap->count--;
+
+	for (size_t j = (i + 1) & mask; keymap->slots[j]; j = (j + 1) & mask) {
+		struct key *moved = keymap->slots[j];
+		size_t k = keymap_hash(moved->modifiers, moved->keysym) & mask;
+		// stays if its home is cyclically in (i, j]
+		bool stays = i <= j ? (i < k && k <= j) : (i < k || k <= j);
+		if (stays) {
+			continue;
+		}
+		keymap->slots[i] = moved;
+		keymap->slots[j] = NULL;
+		i = j;
+	}
+	// masks are only an early out, see keymap_reset_masks
+}
+
+void keymap_reset_masks(void) {
+	struct keymap *keymap = &config.keymap;
+	memset(keymap->masks, 0, sizeof(keymap->masks));
+	struct key *key;
+	wl_list_for_each (key, &config.keybings, link) {
+		uint8_t m = key->modifiers & 0xff;
+		keymap->masks[m >> 6] |= UINT64_C(1) << (m & 63);
+	}
+}
+
+uint64_t now_ns(void) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+/// trace
+
+// binary events in a fixed ring, dumped as chrome trace json (perfetto
+// opens it too) on SIGUSR1, enabled by WLESS_TRACE=path/to/trace.json
+
+enum trace_type {
+	TRACE_FRAME,	 // arg: rendered
+	TRACE_COMMIT,	 // arg: pid
+	TRACE_CONFIGURE, // arg: serial
+	TRACE_ACK,	 // arg: serial
+	TRACE_MAP,	 // arg: pid
+	TRACE_UNMAP,	 // arg: pid
+	TRACE_KEY,	 // arg: keysym
+	TRACE_OUTPUT,	 // arg: width
+	TRACE_PRESENT,	 // arg: seq
+	TRACE_COUNT,
+};
+
+struct trace_event {
+	uint64_t ns;
+	uint32_t type;
+	uint32_t arg;
+};
+
+#define TRACE_SIZE (1 << 16) // power of 2
+
+// only touched from the event loop, signals come through signalfd
+struct trace {
+	struct trace_event *events; // NULL if disabled
+	uint64_t head;
+	const char *path;
+} trace;
+
+// arg is not evaluated when disabled
+#define TRACE(type, arg)                                                       \
+	do {                                                                   \
+		if (__builtin_expect(trace.events != NULL, 0)) {               \
+			trace_add(type, arg);                                  \
+		}                                                              \
+	} while (0)
+
+void trace_add(enum trace_type type, uint32_t arg) {
+	struct trace_event *event =
+		&trace.events[trace.head++ & (TRACE_SIZE - 1)];
+	event->ns = now_ns();
+	event->type = type;
+	event->arg = arg;
+}
+
+void trace_dump(const char *path) {
+	static const char *names[TRACE_COUNT] = {
+		[TRACE_FRAME] = "frame",	 [TRACE_COMMIT] = "commit",
+		[TRACE_CONFIGURE] = "configure", [TRACE_ACK] = "ack",
+		[TRACE_MAP] = "map",		 [TRACE_UNMAP] = "unmap",
+		[TRACE_KEY] = "key",		 [TRACE_OUTPUT] = "output",
+		[TRACE_PRESENT] = "present",
+	};
+
+	if (!trace.events) {
+		wlr_log(WLR_ERROR, "[trace] disabled, set WLESS_TRACE");
+		return;
+	}
+	FILE *fp = fopen(path, "w");
+	if (!fp) {
+		wlr_log_errno(WLR_ERROR, "[trace] failed to open %s", path);
+		return;
+	}
+
+	uint64_t tail = trace.head > TRACE_SIZE ? trace.head - TRACE_SIZE : 0;
+	fprintf(fp, "{\"traceEvents\":[");
+	for (uint64_t i = tail; i < trace.head; i++) {
+		struct trace_event *event = &trace.events[i & (TRACE_SIZE - 1)];
+		fprintf(fp,
+			"%s\n{\"name\":\"%s\",\"ph\":\"i\",\"s\":\"t\","
+			"\"pid\":%d,\"tid\":%" PRIu32 ",\"ts\":%.3f,"
+			"\"args\":{\"arg\":%" PRIu32 "}}",
+			i == tail ? "" : ",", names[event->type], getpid(),
+			event->type, event->ns / 1e3, event->arg);
+	}
+	fprintf(fp, "\n]}\n");
+	fclose(fp);
+
+	wlr_log(WLR_INFO, "[trace] %" PRIu64 " events to %s",
+		trace.head - tail, path);
+}
+
+int trace_signal(int signal_number, void *data) {
+	(void) signal_number;
+	(void) data;
+	trace_dump(trace.path);
+	return 0;
+}
+
+void trace_init(struct wl_event_loop *loop) {
+	trace.path = getenv("WLESS_TRACE");
+	if (!trace.path) {
+		return;
+	}
+	trace.events = calloc(TRACE_SIZE, sizeof(*trace.events));
+	wl_event_loop_add_signal(loop, SIGUSR1, trace_signal, NULL);
+	wlr_log(WLR_INFO, "[trace] enabled, kill -USR1 %d to dump to %s",
+		getpid(), trace.path);
+}
+
+/// spawn
+
+// posix_spawn (vfork-like, no copy of our address space) and reap on
+// SIGCHLD from the event loop, so a binding never stalls a frame
+
+struct child {
+	pid_t pid;
+	char *cmd;
+	struct wl_list link; // server.children
+};
+
+// anything the shell would treat specially
+#define SPAWN_SHELL_CHARS "|&;<>()$`\\\"'*?[]#~=%{}\n"
+
+// split on blanks when there is nothing for the shell to do
+char **spawn_argv(const char *cmd) {
+	if (strpbrk(cmd, SPAWN_SHELL_CHARS)) {
+		return NULL;
+	}
+	size_t argc = 0;
+	char **argv = calloc(strlen(cmd) / 2 + 2, sizeof(*argv));
+	char *buf = strdup(cmd);
+	for (char *arg = strtok(buf, " \t"); arg; arg = strtok(NULL, " \t")) {
+		argv[argc++] = arg;
+	}
+	if (argc == 0) {
+		free(buf);
+		free(argv);
+		return NULL;
+	}
+	return argv; // argv[0] owns buf
+}
+
+void spawn_cmd(const char *cmd) {
+	posix_spawnattr_t attr;
+	posix_spawnattr_init(&attr);
+
+	// the event loop blocks the signals it turns into fds
+	sigset_t mask;
+	sigemptyset(&mask);
+	posix_spawnattr_setsigmask(&attr, &mask);
+	sigaddset(&mask, SIGCHLD);
+	sigaddset(&mask, SIGUSR1);
+	sigaddset(&mask, SIGPIPE);
+	posix_spawnattr_setsigdefault(&attr, &mask);
+	short flags = POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF;
+	posix_spawnattr_setflags(&attr, flags);
+
+	pid_t pid;
+	int err;
+	char **argv = spawn_argv(cmd);
+	bool use_shell = !argv;
+	if (argv) {
+		err = posix_spawnp(&pid, argv[0], NULL, &attr, argv, environ);
+		free(argv[0]);
+		free(argv);
+	} else {
+		char *sh_argv[] = {"/bin/sh", "-c", (char *) cmd, NULL};
+		err = posix_spawn(&pid, sh_argv[0], NULL, &attr, sh_argv,
+				  environ);
+	}
+	posix_spawnattr_destroy(&attr);
+
+	if (err != 0) {
+		wlr_log(WLR_ERROR, "[exec] failed to spawn %s: %s", cmd,
+			strerror(err));
+		return;
+	}
+	wlr_log(WLR_INFO, "[exec] spawn %d %s%s", pid, use_shell ? "sh: " : "",
+		cmd);
+
+	struct child *child = calloc(1, sizeof(*child));
+	child->pid = pid;
+	child->cmd = strdup(cmd);
+	wl_list_insert(&server.children, &child->link);
+}
+
+int spawn_sigchld(int signal_number, void *data) {
+	(void) signal_number;
+	(void) data;
+
+	// signals coalesce, reap everything
+	pid_t pid;
+	int status;
+	while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+		struct child *child, *found = NULL;
+		wl_list_for_each (child, &server.children, link) {
+			if (child->pid == pid) {
+				found = child;
+				break;
+			}
+		}
+		const char *cmd = found ? found->cmd : "?";
+		if (WIFEXITED(status)) {
+			wlr_log(WEXITSTATUS(status) ? WLR_INFO : WLR_DEBUG,
+				"[exec] %d exit %d: %s", pid,
+				WEXITSTATUS(status), cmd);
+		} else if (WIFSIGNALED(status)) {
+			wlr_log(WLR_INFO, "[exec] %d killed by %d: %s", pid,
+				WTERMSIG(status), cmd);
+		}
+		if (found) {
+			wl_list_remove(&found->link);
+			free(found->cmd);
+			free(found);
+		}
+	}
+	return 0;
+}
+
+void spawn_init(struct wl_event_loop *loop) {
+	wl_list_init(&server.children);
+	wl_event_loop_add_signal(loop, SIGCHLD, spawn_sigchld, NULL);
+}
+
 /// getopt
 
 void opt_list_log(int argc, char **argv) {
@@ -158,7 +664,44 @@ void opt_list_log(int argc, char **argv) {
 	wlr_log(WLR_DEBUG, "[opt] list: %s", buf);
 }
 
-void opt_list_from_file(const char *path, int *argc, char ***argv) {
+// names of the variables wordexp may read in line, ~ reads HOME
+void opt_env_scan(const char *line, struct wl_array *names) {
+	for (const char *p = line; *p != '\0'; p++) {
+		const char *name = "HOME";
+		size_t len = 4;
+		if (*p == '$') {
+			name = p + 1 + (p[1] == '{');
+			len = 0;
+			while (isalnum((unsigned char) name[len]) ||
+			       name[len] == '_') {
+				len++;
+			}
+		} else if (*p != '~') {
+			continue;
+		}
+		if (len == 0) {
+			continue;
+		}
+
+		bool found = false;
+		char **ptr;
+		wl_array_for_each(ptr, names) {
+			if (strncmp(*ptr, name, len) == 0 &&
+			    (*ptr)[len] == '\0') {
+				found = true;
+				break;
+			}
+		}
+		if (!found) {
+			ptr = wl_array_add(names, sizeof(*ptr));
+			*ptr = strndup(name, len);
+		}
+	}
+}
+
+// env_names is optional, see opt_env_scan
+void opt_list_from_file(const char *path, int *argc, char ***argv,
+			struct wl_array *env_names) {
 	*argc = 0;
 	*argv = NULL;
 	FILE *fp = fopen(path, "r");
@@ -176,6 +719,9 @@ void opt_list_from_file(const char *path, int *argc, char ***argv) {
 		if (*p == '#' || *p == '\0') {
 			continue;
 		}
+		if (env_names) {
+			opt_env_scan(p, env_names);
+		}
 		if (wordexp(line, &w, WRDE_NOCMD | WRDE_REUSE) != 0) {
 			continue;
 		}
@@ -190,19 +736,14 @@ void opt_list_from_file(const char *path, int *argc, char ***argv) {
 	fclose(fp);
 }
 
-void opt_exec_cmd(const char *cmd) {
-	wlr_log(WLR_INFO, "[exec] spawn %s", cmd);
-	fflush(stdout);
-
-	if (fork() == 0) {
-		execl("/bin/sh", "/bin/sh", "-c", cmd, NULL);
+void opt_list_free(int argc, char **argv) {
+	for (int i = 0; i < argc; i++) {
+		free(argv[i]);
 	}
+	free(argv);
 }
 
-// color fallback
-// ("242424", config.color[0]);
-// ("616161", config.color[1]);
-// ("24acd4", config.color[2]);
+// color fallback, see opt_getopt_all
 void opt_hex_color(const char *hex, float rgba[static 4]) {
 	if (rgba[3] != 0) {
 		return;
@@ -218,6 +759,38 @@ void opt_hex_color(const char *hex, float rgba[static 4]) {
 	rgba[3] = a / 255.0f;
 }
 
+// off, fullscreen or content
+void opt_vrr_set(const char *mode) {
+	for (size_t i = 0; i < ARRAY_SIZE(vrr_names); i++) {
+		if (strcmp(mode, vrr_names[i]) == 0) {
+			config.vrr = i;
+			return;
+		}
+	}
+	wlr_log(WLR_ERROR, "[opt] unknown adaptive sync mode: %s", mode);
+}
+
+// bg=242424,fb=24acd4,nb=616161
+void opt_color_add(const char *entry) {
+	char *subopts[] = {[0] = "bg", [1] = "fb", [2] = "nb", NULL};
+	float *colors[] = {config.color_bg, config.color_fb, config.color_nb};
+
+	char *buf = strdup(entry);
+	char *token = buf;
+	char *value;
+	while (*token != '\0') {
+		int opt_index = getsubopt(&token, subopts, &value);
+		if (opt_index < 0 || !value) {
+			wlr_log(WLR_ERROR, "need bg=xx,fb=yy,nb=zz: %s", entry);
+			break;
+		}
+		// the last one wins, unlike the fallback
+		colors[opt_index][3] = 0;
+		opt_hex_color(value, colors[opt_index]);
+	}
+	free(buf);
+}
+
 xkb_keysym_t opt_name_keysym(const char *name) {
 	assert(name);
 
@@ -253,6 +826,27 @@ void opt_key_log(const struct key *key) {
 	wlr_log(WLR_DEBUG, "[key] %s %5s: %s", mod_buf, key_buf, key->command);
 }
 
+void opt_key_set(uint32_t modifiers, xkb_keysym_t keysym,
+		 const char *command) {
+	struct key *old_key = keymap_lookup(modifiers, keysym);
+	if (old_key) {
+		old_key->stale = false;
+		if (strcmp(old_key->command, command) != 0) {
+			free(old_key->command);
+			old_key->command = strdup(command);
+			command_resolve(old_key);
+		}
+		return;
+	}
+	struct key *new_key = calloc(1, sizeof(*new_key));
+	new_key->command = strdup(command);
+	command_resolve(new_key);
+	new_key->keysym = keysym;
+	new_key->modifiers = modifiers;
+	wl_list_insert(&config.keybings, &new_key->link);
+	keymap_insert(new_key);
+}
+
 // future: set MRU keys to first
 void opt_key_add(const char *entry) {
 	enum wlr_keyboard_modifier modifiers = {0};
@@ -298,25 +892,7 @@ void opt_key_add(const char *entry) {
 		goto out;
 	}
 
-	bool has_found = false;
-	struct key *old_key;
-	wl_list_for_each (old_key, &config.keybings, link) {
-		if (old_key->modifiers == modifiers &&
-		    old_key->keysym == keysym) {
-			has_found = true;
-			break;
-		}
-	}
-	if (has_found) {
-		free(old_key->command);
-		old_key->command = strdup(cmd_str);
-	} else {
-		struct key *new_key = calloc(1, sizeof(*new_key));
-		new_key->command = strdup(cmd_str);
-		new_key->keysym = keysym;
-		new_key->modifiers = modifiers;
-		wl_list_insert(&config.keybings, &new_key->link);
-	}
+	opt_key_set(modifiers, keysym, cmd_str);
 
 out:
 	free(buf);
@@ -330,9 +906,10 @@ void opt_getopt_one(int argc, char **argv, bool from_file) {
 	optind = 1;
 	int c;
 	char **start_cmd;
-	while ((c = getopt(argc, argv, "dhvo:s:r:t:")) != -1) {
+	while ((c = getopt(argc, argv, "dhvo:s:r:t:l:c:a:")) != -1) {
 		switch (c) {
 		case 'd':
+			config.debug = true;
 			wlr_log_init(WLR_DEBUG, NULL);
 			break;
 		case 'h':
@@ -342,6 +919,9 @@ void opt_getopt_one(int argc, char **argv, bool from_file) {
 			opt_key_add(optarg);
 			break;
 		case 's': // start-cmd
+			if (config.reloading) {
+				break;
+			}
 			start_cmd = wl_array_add(&config.start_cmd,
 						 sizeof(start_cmd));
 			*start_cmd = strdup(optarg);
@@ -350,18 +930,262 @@ void opt_getopt_one(int argc, char **argv, bool from_file) {
 			break;
 		case 't': // path of terminal
 			break;
+		case 'l': // render late, margin before vblank in us
+			config.frame_margin = atoi(optarg);
+			break;
+		case 'c': // border and background colors
+			opt_color_add(optarg);
+			break;
+		case 'a': // adaptive sync
+			opt_vrr_set(optarg);
+			break;
 		}
 	}
+}
 
-	if (!from_file) {
-		return;
+/// cache
+
+// wlessrc after parsing, saved as wlessrc.cache and mmapped on startup
+//
+// header | key[keys_len] | start_cmd[start_cmd_len] | env[env_len] | strings
+//
+// offsets point into strings, which ends with '\0'; values are expanded,
+// so env names the variables they came from and env_hash their values
+
+#define OPT_CACHE_MAGIC 0x43534c57 // "WLSC"
+#define OPT_CACHE_VERSION 4
+
+struct opt_cache_header {
+	uint32_t magic;
+	uint32_t version;
+	// stat of wlessrc
+	int64_t mtime_sec;
+	int64_t mtime_nsec;
+	int64_t size;
+	uint64_t ino;
+	// config
+	uint32_t debug;
+	int32_t frame_margin;
+	uint32_t vrr;
+	float color_bg[4];
+	float color_fb[4];
+	float color_nb[4];
+	uint32_t keys_len;
+	uint32_t start_cmd_len;
+	uint32_t env_len;
+	uint32_t strings_size;
+	uint64_t env_hash;
+};
+
+struct opt_cache_key {
+	uint32_t modifiers;
+	uint32_t keysym;
+	uint32_t command; // offset
+};
+
+char *opt_cache_path(const char *config_path) {
+	size_t len = strlen(config_path) + sizeof(".cache");
+	char *path = malloc(len);
+	snprintf(path, len, "%s.cache", config_path);
+	return path;
+}
+
+bool opt_cache_stat(const char *config_path, struct stat *st) {
+	return stat(config_path, st) == 0 && S_ISREG(st->st_mode);
+}
+
+// fnv-1a over NAME=value, an unset variable differs from an empty one
+uint64_t opt_cache_env_hash(uint64_t hash, const char *name) {
+	const char *value = getenv(name);
+	const char *parts[] = {name, value ? "=" : "", value ? value : ""};
+	for (size_t i = 0; i < ARRAY_SIZE(parts); i++) {
+		for (const char *p = parts[i]; *p != '\0'; p++) {
+			hash = (hash ^ (uint8_t) *p) * 0x100000001b3;
+		}
 	}
-	argc--;
-	argv++;
-	for (int i = 0; i < argc; i++) {
-		free(argv[i]);
+	return (hash ^ '\0') * 0x100000001b3;
+}
+
+// st is the stat of config_path taken before it is read
+bool opt_cache_load(const char *config_path, const struct stat *st) {
+	char *path = opt_cache_path(config_path);
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	free(path);
+	if (fd < 0) {
+		return false;
 	}
-	free(argv);
+	struct stat cache_st;
+	if (fstat(fd, &cache_st) < 0 ||
+	    (size_t) cache_st.st_size < sizeof(struct opt_cache_header)) {
+		close(fd);
+		return false;
+	}
+	size_t size = cache_st.st_size;
+	const uint8_t *data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED) {
+		return false;
+	}
+
+	bool is_ok = false;
+	const struct opt_cache_header *header = (const void *) data;
+	if (header->magic != OPT_CACHE_MAGIC ||
+	    header->version != OPT_CACHE_VERSION ||
+	    header->mtime_sec != st->st_mtim.tv_sec ||
+	    header->mtime_nsec != st->st_mtim.tv_nsec ||
+	    header->size != st->st_size || header->ino != st->st_ino ||
+	    header->vrr >= ARRAY_SIZE(vrr_names)) {
+		goto out;
+	}
+
+	const struct opt_cache_key *keys = (const void *) (header + 1);
+	const uint32_t *start_cmd = (const void *) (keys + header->keys_len);
+	const uint32_t *env = start_cmd + header->start_cmd_len;
+	const char *strings = (const char *) (env + header->env_len);
+	size_t expected = (size_t) (strings - (const char *) data) +
+			  header->strings_size;
+	if (expected != size || header->strings_size == 0 ||
+	    strings[header->strings_size - 1] != '\0') {
+		goto out;
+	}
+	for (uint32_t i = 0; i < header->keys_len; i++) {
+		if (keys[i].command >= header->strings_size) {
+			goto out;
+		}
+	}
+	for (uint32_t i = 0; i < header->start_cmd_len; i++) {
+		if (start_cmd[i] >= header->strings_size) {
+			goto out;
+		}
+	}
+	uint64_t env_hash = 0xcbf29ce484222325;
+	for (uint32_t i = 0; i < header->env_len; i++) {
+		if (env[i] >= header->strings_size) {
+			goto out;
+		}
+		env_hash = opt_cache_env_hash(env_hash, strings + env[i]);
+	}
+	if (env_hash != header->env_hash) {
+		wlr_log(WLR_DEBUG, "[opt] cache miss, environment changed");
+		goto out;
+	}
+
+	if (header->debug) {
+		config.debug = true;
+		wlr_log_init(WLR_DEBUG, NULL);
+	}
+	config.frame_margin = header->frame_margin;
+	config.vrr = header->vrr;
+	memcpy(config.color_bg, header->color_bg, sizeof(config.color_bg));
+	memcpy(config.color_fb, header->color_fb, sizeof(config.color_fb));
+	memcpy(config.color_nb, header->color_nb, sizeof(config.color_nb));
+	for (uint32_t i = 0; i < header->keys_len; i++) {
+		opt_key_set(keys[i].modifiers, keys[i].keysym,
+			    strings + keys[i].command);
+	}
+	for (uint32_t i = 0; i < header->start_cmd_len; i++) {
+		char **ptr = wl_array_add(&config.start_cmd, sizeof(*ptr));
+		*ptr = strdup(strings + start_cmd[i]);
+	}
+	is_ok = true;
+	wlr_log(WLR_DEBUG, "[opt] cache hit, %" PRIu32 " keys",
+		header->keys_len);
+
+out:
+	munmap((void *) data, size);
+	return is_ok;
+}
+
+// st is from before the file was read, a later edit makes the cache stale
+void opt_cache_save(const char *config_path, const struct stat *st,
+		    const struct wl_array *env_names) {
+	struct opt_cache_header header = {
+		.magic = OPT_CACHE_MAGIC,
+		.version = OPT_CACHE_VERSION,
+		.mtime_sec = st->st_mtim.tv_sec,
+		.mtime_nsec = st->st_mtim.tv_nsec,
+		.size = st->st_size,
+		.ino = st->st_ino,
+		.debug = config.debug,
+		.frame_margin = config.frame_margin,
+		.vrr = config.vrr,
+		.keys_len = wl_list_length(&config.keybings),
+		.start_cmd_len = config.start_cmd.size / sizeof(char *),
+		.env_len = env_names->size / sizeof(char *),
+		.env_hash = 0xcbf29ce484222325,
+	};
+	memcpy(header.color_bg, config.color_bg, sizeof(header.color_bg));
+	memcpy(header.color_fb, config.color_fb, sizeof(header.color_fb));
+	memcpy(header.color_nb, config.color_nb, sizeof(header.color_nb));
+
+	struct opt_cache_key *keys =
+		calloc(header.keys_len + 1, sizeof(*keys));
+	uint32_t *start_cmd =
+		calloc(header.start_cmd_len + 1, sizeof(*start_cmd));
+	uint32_t *env = calloc(header.env_len + 1, sizeof(*env));
+	struct wl_array strings;
+	wl_array_init(&strings);
+	// never empty, so strings always ends with '\0'
+	*(char *) wl_array_add(&strings, 1) = '\0';
+
+	size_t i = 0;
+	struct key *key;
+	// reversed, opt_key_set inserts to head
+	wl_list_for_each_reverse (key, &config.keybings, link) {
+		keys[i].modifiers = key->modifiers;
+		keys[i].keysym = key->keysym;
+		keys[i].command = strings.size;
+		size_t len = strlen(key->command) + 1;
+		memcpy(wl_array_add(&strings, len), key->command, len);
+		i++;
+	}
+	i = 0;
+	char **ptr;
+	wl_array_for_each(ptr, &config.start_cmd) {
+		start_cmd[i++] = strings.size;
+		size_t len = strlen(*ptr) + 1;
+		memcpy(wl_array_add(&strings, len), *ptr, len);
+	}
+	i = 0;
+	wl_array_for_each(ptr, env_names) {
+		env[i++] = strings.size;
+		size_t len = strlen(*ptr) + 1;
+		memcpy(wl_array_add(&strings, len), *ptr, len);
+		header.env_hash = opt_cache_env_hash(header.env_hash, *ptr);
+	}
+	header.strings_size = strings.size;
+
+	// write and rename, never leave a half cache around
+	char *path = opt_cache_path(config_path);
+	size_t len = strlen(path) + sizeof(".tmp");
+	char *tmp_path = malloc(len);
+	snprintf(tmp_path, len, "%s.tmp", path);
+
+	FILE *fp = fopen(tmp_path, "w");
+	if (fp) {
+		bool is_ok =
+			fwrite(&header, sizeof(header), 1, fp) == 1 &&
+			fwrite(keys, sizeof(*keys), header.keys_len, fp) ==
+				header.keys_len &&
+			fwrite(start_cmd, sizeof(*start_cmd),
+			       header.start_cmd_len,
+			       fp) == header.start_cmd_len &&
+			fwrite(env, sizeof(*env), header.env_len, fp) ==
+				header.env_len &&
+			fwrite(strings.data, 1, strings.size, fp) ==
+				strings.size;
+		is_ok = fclose(fp) == 0 && is_ok;
+		if (!is_ok || rename(tmp_path, path) != 0) {
+			unlink(tmp_path);
+		}
+	}
+
+	free(tmp_path);
+	free(path);
+	wl_array_release(&strings);
+	free(env);
+	free(start_cmd);
+	free(keys);
 }
 
 void opt_getopt_all(int margc, char **margv) {
@@ -422,17 +1246,37 @@ void opt_getopt_all(int margc, char **margv) {
 		config_path = strdup(buf_path);
 	} while (0);
 
-	int fargc;
-	char **fargv;
-	opt_list_from_file(config_path, &fargc, &fargv);
-	free(config_path);
-	opt_list_log(fargc, fargv);
-
 	// file
-	opt_getopt_one(fargc, fargv, true);
+	struct stat st;
+	bool has_stat = opt_cache_stat(config_path, &st);
+	if (!has_stat || !opt_cache_load(config_path, &st)) {
+		int fargc;
+		char **fargv;
+		struct wl_array env_names;
+		wl_array_init(&env_names);
+		opt_list_from_file(config_path, &fargc, &fargv, &env_names);
+		opt_list_log(fargc, fargv);
+		opt_getopt_one(fargc, fargv, true);
+		opt_list_free(fargc, fargv);
+		if (has_stat) {
+			opt_cache_save(config_path, &st, &env_names);
+		}
+		char **name;
+		wl_array_for_each(name, &env_names) {
+			free(*name);
+		}
+		wl_array_release(&env_names);
+	}
+	config.path = config_path;
 
 	// cli
 	opt_getopt_one(margc, margv, false);
+	config.argc = margc;
+	config.argv = margv;
+
+	opt_hex_color("242424", config.color_bg);
+	opt_hex_color("24acd4", config.color_fb);
+	opt_hex_color("616161", config.color_nb);
 
 	// log
 	struct key *key;
@@ -443,26 +1287,32 @@ void opt_getopt_all(int margc, char **margv) {
 	wl_array_for_each(start_cmd, &config.start_cmd) {
 		wlr_log(WLR_DEBUG, "[opt] start_cmd: %s", *start_cmd);
 	}
+	wlr_log(WLR_DEBUG, "[opt] frame_margin: %dus", config.frame_margin);
+	wlr_log(WLR_DEBUG, "[opt] adaptive sync: %s", vrr_names[config.vrr]);
 }
 
 /// client
 
+uint32_t client_pid(struct client *client) {
+	pid_t pid = 0;
+	wl_client_get_credentials(
+		wl_resource_get_client(client->xdg_toplevel->resource), &pid,
+		NULL, NULL);
+	return pid;
+}
+
+// the output showing this client, NULL if hidden
+//
+// client->output is kept by client_show instead of looking into
+// surface->current_outputs, a hidden client stays sized for it
 struct output *client_output(struct client *client) {
 	assert(client);
 
-	struct wlr_surface *surface = client->xdg_toplevel->base->surface;
-	struct wl_list *current_outputs = &surface->current_outputs;
-
-	if (wl_list_empty(current_outputs)) {
-		return NULL;
+	struct output *output = client->output;
+	if (output && output->current_client == client) {
+		return output;
 	}
-
-	// return the first one
-	struct wlr_surface_output *surface_output =
-		wl_container_of(current_outputs->next, surface_output, link);
-	struct output *output =
-		wl_container_of(surface_output->output, output, wlr_output);
-	return output;
+	return NULL;
 }
 
 // the focused output may have an empty client
@@ -479,31 +1329,358 @@ struct client *client_first(bool is_free) {
 	return NULL;
 }
 
+// the opaque region covers the whole window geometry
+bool client_opaque(struct client *client) {
+	struct wlr_xdg_surface *xdg_surface = client->xdg_toplevel->base;
+	struct wlr_box *geometry = &xdg_surface->geometry;
+	pixman_box32_t box = {
+		.x1 = geometry->x,
+		.y1 = geometry->y,
+		.x2 = geometry->x + geometry->width,
+		.y2 = geometry->y + geometry->height,
+	};
+	return pixman_region32_contains_rectangle(
+		       &xdg_surface->surface->opaque_region, &box) ==
+	       PIXMAN_REGION_IN;
+}
+
+// games and videos tell apart by wp_content_type_v1, text apps keep a
+// fixed refresh rate either way
+bool client_wants_vrr(struct client *client) {
+	struct wlr_xdg_toplevel *xdg_toplevel = client->xdg_toplevel;
+	if (config.vrr == VRR_OFF || !xdg_toplevel->current.fullscreen) {
+		return false;
+	}
+	if (config.vrr == VRR_FULLSCREEN) {
+		return true;
+	}
+	enum wp_content_type_v1_type type = wlr_surface_get_content_type_v1(
+		server.content_type_manager, xdg_toplevel->base->surface);
+	return type == WP_CONTENT_TYPE_V1_TYPE_GAME ||
+	       type == WP_CONTENT_TYPE_V1_TYPE_VIDEO;
+}
+
 void client_position(struct client *client, struct output *output) {
 	int width = client->xdg_toplevel->pending.width;
 	int height = client->xdg_toplevel->pending.height;
-	struct wlr_box *output_box = &output->output_box;
+	struct wlr_box *usable_box = &output->usable_box;
 
-	int x = (output_box->width - width) / 2 + output_box->x;
-	int y = (output_box->height - height) / 2 + output_box->y;
+	int x = (usable_box->width - width) / 2 + usable_box->x;
+	int y = (usable_box->height - height) / 2 + usable_box->y;
 	wlr_scene_node_set_position(&client->scene_tree->node, x, y);
 
-	// output_set_border
+	output_update_scanout(output);
 }
 
-// emit: surface_handle_commit
-void toplevel_client_commit_notify(struct wl_listener *listener, void *data) {
-	struct client *client =
-		wl_container_of(listener, client, client_commit);
+/// transaction
+
+// configure clients, keep showing their old buffers, and put everything
+// in place in one go once all of them have acked (or the timer fires)
+
+#define TXN_TIMEOUT_MS 200
+
+void client_snapshot_iter(struct wlr_scene_buffer *scene_buffer, int sx,
+			  int sy, void *data) {
+	struct wlr_scene_tree *snapshot = data;
+	if (!scene_buffer->buffer) {
+		return;
+	}
+
+	// locks the buffer until the snapshot is dropped, an explicit sync
+	// release point waits on that lock too
+	struct wlr_scene_buffer *copy =
+		wlr_scene_buffer_create(snapshot, scene_buffer->buffer);
+	if (!copy) {
+		return;
+	}
+	// sx, sy include the offset of the live tree, which the snapshot
+	// tree already has
+	wlr_scene_node_set_position(&copy->node, sx - snapshot->node.x,
+				    sy - snapshot->node.y);
+	wlr_scene_buffer_set_dest_size(copy, scene_buffer->dst_width,
+				       scene_buffer->dst_height);
+	wlr_scene_buffer_set_source_box(copy, &scene_buffer->src_box);
+	wlr_scene_buffer_set_transform(copy, scene_buffer->transform);
+	wlr_scene_buffer_set_opaque_region(copy, &scene_buffer->opaque_region);
+}
+
+void client_snapshot(struct client *client) {
+	if (client->snapshot || !client->scene_tree) {
+		return;
+	}
+	struct wlr_scene_node *live = &client->scene_tree->node;
+
+	client->snapshot = wlr_scene_tree_create(live->parent);
+	wlr_scene_node_set_position(&client->snapshot->node, live->x, live->y);
+	wlr_scene_node_place_above(&client->snapshot->node, live);
+	wlr_scene_node_for_each_buffer(live, client_snapshot_iter,
+				       client->snapshot);
+	wlr_scene_node_set_enabled(live, false);
+}
+
+void client_snapshot_drop(struct client *client) {
+	if (!client->snapshot) {
+		return;
+	}
+	wlr_scene_node_destroy(&client->snapshot->node);
+	client->snapshot = NULL;
+	wlr_scene_node_set_enabled(&client->scene_tree->node,
+				   client_output(client) != NULL);
+}
+
+void txn_apply(void) {
+	wl_event_source_timer_update(server.txn_timer, 0);
+	server.txn_pending = 0;
+
+	struct client *client;
+	wl_list_for_each (client, &server.clients, link) {
+		client->txn_serial = 0;
+		client_snapshot_drop(client);
+	}
+
+	struct output *output;
+	wl_list_for_each (output, &server.outputs, link) {
+		if (output->current_client) {
+			client_position(output->current_client, output);
+		}
+	}
+}
+
+int txn_timeout(void *data) {
 	(void) data;
+	wlr_log(WLR_DEBUG, "[txn] timeout with %zu clients pending",
+		server.txn_pending);
+	txn_apply();
+	return 0;
+}
+
+// visible clients only, the hidden ones are just configured
+void txn_add(struct client *client, int32_t width, int32_t height) {
+	client_snapshot(client);
+	if (!client->txn_serial) {
+		server.txn_pending++;
+	}
+	client->txn_serial =
+		wlr_xdg_toplevel_set_size(client->xdg_toplevel, width, height);
+	TRACE(TRACE_CONFIGURE, client->txn_serial);
+}
+
+void txn_commit(void) {
+	if (server.txn_pending == 0) {
+		txn_apply();
+		return;
+	}
+	wl_event_source_timer_update(server.txn_timer, TXN_TIMEOUT_MS);
+}
+
+// acked, unmapped or gone
+void txn_client_done(struct client *client) {
+	if (!client->txn_serial) {
+		return;
+	}
+	client->txn_serial = 0;
+	if (--server.txn_pending == 0) {
+		txn_apply();
+	}
+}
+
+/// switcher
+
+// server.clients is the MRU list, the head is the last shown one
+//
+// - HEAD, A, B, C, D
+// - A, HEAD, B, C, D
+
+// hidden ones are suspended and get no frame done, so well behaved
+// clients stop rendering until shown again
+void client_set_suspended(struct client *client, bool suspended) {
+	struct wlr_xdg_toplevel *xdg_toplevel = client->xdg_toplevel;
+	if (wl_resource_get_version(xdg_toplevel->resource) <
+	    XDG_TOPLEVEL_STATE_SUSPENDED_SINCE_VERSION) {
+		return;
+	}
+	if (xdg_toplevel->scheduled.suspended == suspended) {
+		return;
+	}
+	wlr_xdg_toplevel_set_suspended(xdg_toplevel, suspended);
+}
+
+// NULL to clear, keys held down are sent along
+// index into keyboard->consumed, or -1
+int keyboard_consumed(struct keyboard *keyboard, uint32_t keycode) {
+	for (size_t i = 0; i < keyboard->consumed_len; i++) {
+		if (keyboard->consumed[i] == keycode) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+void seat_keyboard_enter(struct wlr_surface *surface) {
+	if (!surface) {
+		wlr_seat_keyboard_notify_clear_focus(server.seat);
+		return;
+	}
+	struct wlr_keyboard *wlr_keyboard = wlr_seat_get_keyboard(server.seat);
+	if (!wlr_keyboard) {
+		wlr_seat_keyboard_notify_enter(server.seat, surface, NULL, 0,
+					       NULL);
+		return;
+	}
+	// the client never sees a press that ran a keybinding
+	struct keyboard *keyboard = wlr_keyboard->data;
+	uint32_t keycodes[WLR_KEYBOARD_KEYS_CAP];
+	size_t keycodes_len = 0;
+	for (size_t i = 0; i < wlr_keyboard->num_keycodes; i++) {
+		uint32_t keycode = wlr_keyboard->keycodes[i];
+		if (keyboard_consumed(keyboard, keycode) < 0) {
+			keycodes[keycodes_len++] = keycode;
+		}
+	}
+	wlr_seat_keyboard_notify_enter(server.seat, surface, keycodes,
+				       keycodes_len, &wlr_keyboard->modifiers);
+}
+
+// keyboard focus and the focus border follow the last shown client
+void client_focus(struct client *client) {
+	struct client *old_client = server.focus;
+	if (old_client == client) {
+		return;
+	}
+	server.focus = client;
+	if (old_client) {
+		wlr_xdg_toplevel_set_activated(old_client->xdg_toplevel, false);
+		if (old_client->output) {
+			output_set_color(old_client->output, config.color_nb);
+		}
+	}
+	// an exclusive layer surface keeps the keyboard, layer_unmap_notify
+	// gives it to server.focus
+	bool keyboard = !server.exclusive_layer;
+	if (!client) {
+		if (keyboard) {
+			seat_keyboard_enter(NULL);
+		}
+		return;
+	}
+	wlr_xdg_toplevel_set_activated(client->xdg_toplevel, true);
+	output_set_color(client->output, config.color_fb);
+	if (keyboard) {
+		seat_keyboard_enter(client->xdg_toplevel->base->surface);
+	}
+}
+
+void client_promote(struct client *client) {
+	wl_list_remove(&client->link);
+	wl_list_insert(&server.clients, &client->link);
+}
+
+// hidden clients keep their scene buffers, so the last frame is still
+// there when they are shown again
+void client_hide(struct client *client) {
+	if (server.focus == client) {
+		client_focus(NULL);
+	}
+	client_snapshot_drop(client);
+	txn_client_done(client);
+	wlr_scene_node_set_enabled(&client->scene_tree->node, false);
+	client_set_suspended(client, true);
+}
+
+// size the next one for this output ahead of the switch
+void client_prewarm(struct output *output) {
+	struct client *client = client_first(true);
+	if (!client) {
+		return;
+	}
+	struct wlr_xdg_toplevel *xdg_toplevel = client->xdg_toplevel;
+	struct wlr_box *usable_box = &output->usable_box;
+	client->output = output;
+	if (xdg_toplevel->pending.width != usable_box->width ||
+	    xdg_toplevel->pending.height != usable_box->height) {
+		wlr_xdg_toplevel_set_size(xdg_toplevel, usable_box->width,
+					  usable_box->height);
+	}
+}
+
+// client may be NULL to leave the output empty
+void client_show(struct output *output, struct client *client) {
+	struct client *old_client = output->current_client;
+	// an empty output still needs its scanout state, e.g. on hot-add
+	if (client && old_client == client) {
+		return;
+	}
+	if (old_client) {
+		output->current_client = NULL;
+		client_hide(old_client);
+	}
+	output->vrr_failed = false;
+	if (!client) {
+		output_update_scanout(output);
+		output_update_vrr(output);
+		return;
+	}
+
+	struct output *old_output = client_output(client);
+	if (old_output) {
+		old_output->current_client = NULL;
+		old_output->vrr_failed = false;
+		output_update_scanout(old_output);
+		output_update_vrr(old_output);
+	}
 
-	// XXX
-	assert(client->output);
+	output->current_client = client;
+	client->output = output;
+	client_promote(client);
+
+	struct wlr_scene_node *node = &client->scene_tree->node;
+	wlr_scene_node_set_enabled(node, true);
+	wlr_scene_node_raise_to_top(node);
+	client_set_suspended(client, false);
+	output_update_vrr(output);
+	client_focus(client);
+
+	struct wlr_xdg_toplevel *xdg_toplevel = client->xdg_toplevel;
+	struct wlr_box *usable_box = &output->usable_box;
+	if (xdg_toplevel->pending.width != usable_box->width ||
+	    xdg_toplevel->pending.height != usable_box->height) {
+		txn_add(client, usable_box->width, usable_box->height);
+		txn_commit();
+	} else {
+		client_position(client, output);
+	}
+
+	client_prewarm(output);
+}
+
+// alt+tab, the next one in MRU order not shown anywhere
+void client_switch(struct output *output) {
+	struct client *client = client_first(true);
+	if (client) {
+		client_show(output, client);
+	}
+}
+
+// emit: surface_handle_commit
+void toplevel_client_commit_notify(struct wl_listener *listener, void *data) {
+	struct client *client =
+		wl_container_of(listener, client, client_commit);
+	(void) data;
+	TRACE(TRACE_COMMIT, client_pid(client));
+	client->commits++;
 
 	struct wlr_xdg_surface *xdg_surface = client->xdg_toplevel->base;
 	if (xdg_surface->initial_commit) {
 		return;
 	}
+	// XXX no output at initial commit
+	if (!client->output) {
+		return;
+	}
+	// txn_apply would position it
+	if (client->snapshot) {
+		return;
+	}
 	if (!xdg_surface->surface->mapped) {
 		return;
 	}
@@ -525,42 +1702,123 @@ void toplevel_commit_notify(struct wl_listener *listener, void *data) {
 
 	struct wlr_xdg_surface *xdg_surface = client->xdg_toplevel->base;
 	if (!xdg_surface->initial_commit) {
+		int32_t acked = xdg_surface->current.configure_serial;
+		if (client->txn_serial &&
+		    acked - (int32_t) client->txn_serial >= 0) {
+			TRACE(TRACE_ACK, acked);
+			txn_client_done(client);
+		}
+		// geometry, fullscreen and content type are applied now
+		struct output *output = client->output;
+		if (output && output->current_client == client) {
+			output_update_scanout(output);
+			output_update_vrr(output);
+		}
 		return;
 	}
 	struct output *output = output_first(false);
 	int32_t width = 0, height = 0;
 	if (output) {
-		width = output->output_box.width;
-		height = output->output_box.height;
+		width = output->usable_box.width;
+		height = output->usable_box.height;
 	} else {
 		wlr_log(WLR_ERROR,
 			"[surface] initial_commit to an empty output?");
 	}
-	wlr_xdg_toplevel_set_size(client->xdg_toplevel, width, height);
+	uint32_t serial =
+		wlr_xdg_toplevel_set_size(client->xdg_toplevel, width, height);
+	TRACE(TRACE_CONFIGURE, serial);
+}
+
+void toplevel_foreign_update(struct client *client) {
+	struct wlr_ext_foreign_toplevel_handle_v1_state state = {
+		.title = client->xdg_toplevel->title,
+		.app_id = client->xdg_toplevel->app_id,
+	};
+	if (client->foreign_toplevel) {
+		wlr_ext_foreign_toplevel_handle_v1_update_state(
+			client->foreign_toplevel, &state);
+	} else {
+		client->foreign_toplevel =
+			wlr_ext_foreign_toplevel_handle_v1_create(
+				server.foreign_toplevel_list, &state);
+	}
+}
+
+void toplevel_set_title_notify(struct wl_listener *listener, void *data) {
+	struct client *client = wl_container_of(listener, client, set_title);
+	(void) data;
+	if (client->foreign_toplevel) {
+		toplevel_foreign_update(client);
+	}
+}
+
+void toplevel_set_app_id_notify(struct wl_listener *listener, void *data) {
+	struct client *client = wl_container_of(listener, client, set_app_id);
+	(void) data;
+	if (client->foreign_toplevel) {
+		toplevel_foreign_update(client);
+	}
 }
 
 // emit: wlr_surface_map
 void toplevel_map_notify(struct wl_listener *listener, void *data) {
 	struct client *client = wl_container_of(listener, client, map);
+	TRACE(TRACE_MAP, client_pid(client));
 	wl_list_insert(&server.clients, &client->link);
+	toplevel_foreign_update(client);
 
 	// TODO
 	// check scene_xdg_surface_update_position
 	// TODO
 	// use wlr_scene_tree from output?
-	client->scene_tree = wlr_scene_xdg_surface_create(
-		&server.scene->tree, client->xdg_toplevel->base);
-	client->scene_tree->node.data = client;
-	client->xdg_toplevel->base->data = client->scene_tree;
+	// the tree lives until xdg_surface is destroyed, so only once
+	if (!client->scene_tree) {
+		client->scene_tree = wlr_scene_xdg_surface_create(
+			server.layer_monocle, client->xdg_toplevel->base);
+		client->scene_tree->node.data = client;
+		client->xdg_toplevel->base->data = client->scene_tree;
+	}
+
+	// sized for it at initial commit, output_layout_arrange picks the
+	// client up if there is none
+	struct output *output = output_first(false);
+	if (!output) {
+		client->output = NULL;
+		wlr_scene_node_set_enabled(&client->scene_tree->node, false);
+		client_set_suspended(client, true);
+		return;
+	}
+	client_show(output, client);
 }
 
 // emit: wlr_surface_unmap
 void toplevel_unmap_notify(struct wl_listener *listener, void *data) {
 	struct client *client = wl_container_of(listener, client, unmap);
-	wl_list_remove(&client->link);
+	TRACE(TRACE_UNMAP, client_pid(client));
+	wlr_log(WLR_DEBUG,
+		"[client] %d unmap: %" PRIu64 " frames, %" PRIu64 " commits",
+		client_pid(client), client->frames, client->commits);
+	client_snapshot_drop(client);
+	txn_client_done(client);
+	if (client->foreign_toplevel) {
+		wlr_ext_foreign_toplevel_handle_v1_destroy(
+			client->foreign_toplevel);
+		client->foreign_toplevel = NULL;
+	}
 
-	struct client *client_next = client_first(false);
-	TODO(focus on client) client_next;
+	if (server.focus == client) {
+		client_focus(NULL);
+	}
+	struct output *output = client_output(client);
+	wl_list_remove(&client->link);
+	// out of server.clients, so output_destroy would not reset it
+	client->output = NULL;
+	if (!output) {
+		return;
+	}
+	output->current_client = NULL;
+	client_show(output, client_first(true));
 }
 
 void toplevel_request_fullscreen_notify(struct wl_listener *listener,
@@ -582,10 +1840,13 @@ void toplevel_destroy(struct wl_listener *listener, void *data) {
 	struct client *client = wl_container_of(listener, client, destroy);
 	(void) data;
 
+	wl_list_remove(&client->client_commit.link);
 	wl_list_remove(&client->map.link);
 	wl_list_remove(&client->unmap.link);
 	wl_list_remove(&client->commit.link);
 	wl_list_remove(&client->request_fullscreen.link);
+	wl_list_remove(&client->set_title.link);
+	wl_list_remove(&client->set_app_id.link);
 	wl_list_remove(&client->destroy.link);
 
 	free(client);
@@ -617,10 +1878,155 @@ void new_xdg_toplevel_notify(struct wl_listener *listener, void *data) {
 	wl_signal_add(&xdg_toplevel->events.request_fullscreen,
 		      &client->request_fullscreen);
 
+	client->set_title.notify = toplevel_set_title_notify;
+	wl_signal_add(&xdg_toplevel->events.set_title, &client->set_title);
+
+	client->set_app_id.notify = toplevel_set_app_id_notify;
+	wl_signal_add(&xdg_toplevel->events.set_app_id, &client->set_app_id);
+
 	client->destroy.notify = toplevel_destroy;
 	wl_signal_add(&xdg_toplevel->events.destroy, &client->destroy);
 }
 
+/// activation
+
+// a jump shows the most recent client whose app_id or title matches a
+// REGEX, from the jump keybinding command or from a token with app_id
+// "jump:REGEX"; patterns stay compiled for the next time. xdg-activation
+// is only honored for tokens that carry a recent input serial of our seat
+
+#define JUMP_PREFIX "jump:"
+#define JUMP_CACHE_SIZE 16
+
+struct jump {
+	char *pattern;
+	regex_t regex;
+	struct wl_list link; // server.jumps, MRU
+};
+
+// pattern is not nul terminated, it may be followed by a command
+regex_t *jump_regex(const char *pattern, size_t len) {
+	struct jump *jump;
+	wl_list_for_each (jump, &server.jumps, link) {
+		if (strlen(jump->pattern) == len &&
+		    strncmp(jump->pattern, pattern, len) == 0) {
+			wl_list_remove(&jump->link);
+			wl_list_insert(&server.jumps, &jump->link);
+			return &jump->regex;
+		}
+	}
+
+	jump = calloc(1, sizeof(*jump));
+	jump->pattern = strndup(pattern, len);
+	if (regcomp(&jump->regex, jump->pattern, REG_EXTENDED | REG_NOSUB) !=
+	    0) {
+		wlr_log(WLR_ERROR, "[jump] bad regex: %s", jump->pattern);
+		free(jump->pattern);
+		free(jump);
+		return NULL;
+	}
+	wl_list_insert(&server.jumps, &jump->link);
+
+	if (wl_list_length(&server.jumps) > JUMP_CACHE_SIZE) {
+		struct jump *last =
+			wl_container_of(server.jumps.prev, last, link);
+		wl_list_remove(&last->link);
+		regfree(&last->regex);
+		free(last->pattern);
+		free(last);
+	}
+	return &jump->regex;
+}
+
+// server.clients is in MRU order
+struct client *jump_client(regex_t *regex) {
+	struct client *client;
+	wl_list_for_each (client, &server.clients, link) {
+		const char *app_id = client->xdg_toplevel->app_id;
+		const char *title = client->xdg_toplevel->title;
+		if ((app_id && regexec(regex, app_id, 0, NULL, 0) == 0) ||
+		    (title && regexec(regex, title, 0, NULL, 0) == 0)) {
+			return client;
+		}
+	}
+	return NULL;
+}
+
+struct client *client_from_surface(struct wlr_surface *surface) {
+	struct wlr_xdg_toplevel *xdg_toplevel =
+		wlr_xdg_toplevel_try_from_wlr_surface(surface);
+	if (!xdg_toplevel || !xdg_toplevel->base->data) {
+		return NULL;
+	}
+	struct wlr_scene_tree *scene_tree = xdg_toplevel->base->data;
+	return scene_tree->node.data;
+}
+
+void client_activate(struct client *client) {
+	struct output *output = client->output;
+	if (!output || !output_usable(output)) {
+		output = output_first(false);
+	}
+	if (output) {
+		client_show(output, client);
+	}
+}
+
+// a token without seat and serial comes from no user action, e.g. one
+// passed down to a new client, which is shown on map anyway
+bool token_valid(struct wlr_xdg_activation_token_v1 *token) {
+	if (token->seat != server.seat || !token->surface) {
+		return false;
+	}
+	struct wl_client *wl_client =
+		wl_resource_get_client(token->surface->resource);
+	struct wlr_seat_client *seat_client =
+		wlr_seat_client_for_wl_client(server.seat, wl_client);
+	return seat_client && wlr_seat_client_validate_event_serial(
+				      seat_client, token->serial);
+}
+
+// a launcher or panel asks for a jump with the serial of its own input
+void new_token_notify(struct wl_listener *listener, void *data) {
+	(void) listener;
+	struct wlr_xdg_activation_token_v1 *token = data;
+
+	const char *app_id = token->app_id;
+	size_t prefix_len = strlen(JUMP_PREFIX);
+	if (!app_id || strncmp(app_id, JUMP_PREFIX, prefix_len) != 0) {
+		return;
+	}
+	if (!token_valid(token)) {
+		wlr_log(WLR_DEBUG, "[jump] %s: no input serial, ignored",
+			app_id);
+		return;
+	}
+	const char *pattern = app_id + prefix_len;
+	regex_t *regex = jump_regex(pattern, strlen(pattern));
+	struct client *client = regex ? jump_client(regex) : NULL;
+	if (client) {
+		wlr_log(WLR_DEBUG, "[jump] %s", app_id);
+		client_activate(client);
+	}
+}
+
+// the client started with XDG_ACTIVATION_TOKEN, or any other request
+void request_activate_notify(struct wl_listener *listener, void *data) {
+	(void) listener;
+	struct wlr_xdg_activation_v1_request_activate_event *event = data;
+
+	struct client *client = client_from_surface(event->surface);
+	if (!client) {
+		return;
+	}
+	if (!token_valid(event->token)) {
+		wlr_log(WLR_DEBUG, "[activation] %d: no input serial, ignored",
+			client_pid(client));
+		return;
+	}
+	client_activate(client);
+}
+
 /// output
 
 struct output *output_first(bool single) {
@@ -671,6 +2077,30 @@ void output_manager_send_config(void) {
 						config);
 }
 
+// swapchain_manager is only needed for modesets, frames use the output's
+bool output_build_states(
+	struct wlr_backend_output_state *states, size_t states_len,
+	struct wlr_output_swapchain_manager *swapchain_manager) {
+	for (size_t i = 0; i < states_len; i++) {
+		struct wlr_backend_output_state *backend_state = &states[i];
+		struct wlr_output *wlr_output = backend_state->output;
+		struct wlr_scene_output_state_options options = {0};
+		if (swapchain_manager) {
+			options.swapchain =
+				wlr_output_swapchain_manager_get_swapchain(
+					swapchain_manager, wlr_output);
+		}
+		struct wlr_output_state *state = &backend_state->base;
+		struct wlr_scene_output *scene_output =
+			wlr_scene_get_scene_output(server.scene, wlr_output);
+		if (!wlr_scene_output_build_state(scene_output, state,
+						  &options)) {
+			return false;
+		}
+	}
+	return true;
+}
+
 bool output_manager_update(struct wlr_output_configuration_v1 *config,
 			   bool test_only) {
 	bool is_ok = false;
@@ -691,23 +2121,9 @@ bool output_manager_update(struct wlr_output_configuration_v1 *config,
 		goto out;
 	}
 
-	for (size_t i = 0; i < states_len; i++) {
-		struct wlr_backend_output_state *backend_state = &states[i];
-		struct wlr_output *wlr_output = backend_state->output;
-		struct wlr_swapchain *swapchain =
-			wlr_output_swapchain_manager_get_swapchain(
-				&swapchain_manager, wlr_output);
-		struct wlr_scene_output_state_options options = {
-			.swapchain = swapchain,
-		};
-		struct wlr_output_state *state = &backend_state->base;
-		struct wlr_scene_output *scene_output =
-			wlr_scene_get_scene_output(server.scene, wlr_output);
-		is_ok = wlr_scene_output_build_state(scene_output, state,
-						     &options);
-		if (!is_ok) {
-			goto out;
-		}
+	is_ok = output_build_states(states, states_len, &swapchain_manager);
+	if (!is_ok) {
+		goto out;
 	}
 
 	is_ok = wlr_backend_commit(server.backend, states, states_len);
@@ -760,6 +2176,55 @@ void output_manager_apply_notify(struct wl_listener *listener, void *data) {
 	wlr_output_configuration_v1_destroy(config);
 }
 
+// layer surfaces take their exclusive zones out of output_box, from
+// overlay down to background, and clients get what is left
+void output_arrange(struct output *output) {
+	struct wlr_box full_box = output->output_box;
+	struct wlr_box usable_box = full_box;
+
+	for (int i = ARRAY_SIZE(output->layers) - 1; i >= 0; i--) {
+		struct layer *layer;
+		wl_list_for_each (layer, &output->layer_surfaces, link) {
+			struct wlr_layer_surface_v1 *layer_surface =
+				layer->layer_surface;
+			if (!layer_surface->initialized ||
+			    layer_surface->current.layer != (uint32_t) i) {
+				continue;
+			}
+			wlr_scene_layer_surface_v1_configure(
+				layer->scene, &full_box, &usable_box);
+		}
+	}
+
+	if (wlr_box_equal(&usable_box, &output->usable_box)) {
+		return;
+	}
+	bool same_size = usable_box.width == output->usable_box.width &&
+			 usable_box.height == output->usable_box.height;
+	output->usable_box = usable_box;
+	// moved only, txn_commit would position clients
+	if (same_size) {
+		return;
+	}
+	wlr_log(WLR_INFO, "[output] output_arrange %s: %dx%d",
+		output_name(output), usable_box.width, usable_box.height);
+	TRACE(TRACE_OUTPUT, usable_box.width);
+
+	struct client *client;
+	wl_list_for_each (client, &server.clients, link) {
+		if (client->output != output) {
+			continue;
+		}
+		if (client == output->current_client) {
+			txn_add(client, usable_box.width, usable_box.height);
+		} else {
+			wlr_xdg_toplevel_set_size(client->xdg_toplevel,
+						  usable_box.width,
+						  usable_box.height);
+		}
+	}
+}
+
 void output_set_box(struct output *output, const struct wlr_box output_box) {
 	if (!output->wlr_output->enabled) {
 		return;
@@ -770,39 +2235,110 @@ void output_set_box(struct output *output, const struct wlr_box output_box) {
 		wlr_output_state_set_enabled(&state, false);
 		wlr_output_commit_state(output->wlr_output, &state);
 	}
-	bool same_size = output_box.width == output->output_box.width &&
-			 output_box.height == output->output_box.height;
-	if (same_size) {
+	if (wlr_box_equal(&output_box, &output->output_box)) {
 		return;
 	}
 	output->output_box = output_box;
-	wlr_log(WLR_INFO, "[output] output_arrange %s: %dx%d",
-		output_name(output), output_box.width,
-		output->output_box.height);
+	output_arrange(output);
 }
 
-void output_layout_output_destroy_notify(struct wl_listener *listener,
-					 void *data) {
-	(void) listener;
-	struct wlr_output_layout_output *output_layout_output = data;
-	struct output *output = output_layout_output->output->data;
+// off, or out of output_layout
+bool output_usable(struct output *output) {
+	return output->wlr_output->enabled &&
+	       !wlr_box_empty(&output->output_box);
+}
 
-	wl_list_remove(&output->output_layout_output_destroy.link);
+// every layout event of one dispatch ends up here, so a dock or undock
+// storm sizes outputs and moves clients once, and txn_commit puts them
+// all in place in the same frame
+void output_layout_arrange(void *data) {
+	(void) data;
+	server.layout_idle = NULL;
 
-	// if output_first has empty client, move client to it)
-	if (!output->current_client) {
-		return;
-	}
-	struct output *output_0 = output_first(false);
-	if (output_0->current_client) {
-		return;
+	struct wlr_box output_box = {0};
+	struct output *output;
+	wl_list_for_each (output, &server.outputs, link) {
+		wlr_output_layout_get_box(server.output_layout,
+					  output->wlr_output, &output_box);
+		output_set_box(output, output_box);
 	}
-	// TODO
-	// move client to output_first and arrange
-}
 
-void output_layout_add_notify(struct wl_listener *listener, void *data) {
-	(void) listener;
+	// clients leave outputs that went away, see also output_destroy
+	struct client *client;
+	wl_list_for_each (client, &server.clients, link) {
+		output = client->output;
+		if (!output || output_usable(output)) {
+			continue;
+		}
+		if (output->current_client == client) {
+			output->current_client = NULL;
+			client_hide(client);
+		}
+		client->output = NULL;
+	}
+
+	// empty outputs take the next free ones in MRU order, and the focus
+	// stays where it was
+	struct client *focus = server.focus;
+	wl_list_for_each (output, &server.outputs, link) {
+		if (!output_usable(output) || output->current_client) {
+			continue;
+		}
+		client = client_first(true);
+		if (!client) {
+			break;
+		}
+		wlr_log(WLR_DEBUG, "[output] %d moves to %s",
+			client_pid(client), output_name(output));
+		client_show(output, client);
+	}
+	if (focus && client_output(focus)) {
+		client_focus(focus);
+	}
+
+	// and the rest waits on the first output
+	struct output *output_0 = output_first(false);
+	wl_list_for_each (client, &server.clients, link) {
+		if (client->output || !output_0) {
+			continue;
+		}
+		client->output = output_0;
+		struct wlr_xdg_toplevel *xdg_toplevel = client->xdg_toplevel;
+		struct wlr_box *usable_box = &output_0->usable_box;
+		if (xdg_toplevel->pending.width != usable_box->width ||
+		    xdg_toplevel->pending.height != usable_box->height) {
+			wlr_xdg_toplevel_set_size(xdg_toplevel,
+						  usable_box->width,
+						  usable_box->height);
+		}
+	}
+
+	txn_commit();
+	output_manager_send_config();
+}
+
+void output_layout_schedule(void) {
+	if (server.layout_idle) {
+		return;
+	}
+	struct wl_event_loop *loop =
+		wl_display_get_event_loop(server.wl_display);
+	server.layout_idle =
+		wl_event_loop_add_idle(loop, output_layout_arrange, NULL);
+}
+
+void output_layout_output_destroy_notify(struct wl_listener *listener,
+					 void *data) {
+	(void) listener;
+	struct wlr_output_layout_output *output_layout_output = data;
+	struct output *output = output_layout_output->output->data;
+
+	wl_list_remove(&output->output_layout_output_destroy.link);
+	output_layout_schedule();
+}
+
+void output_layout_add_notify(struct wl_listener *listener, void *data) {
+	(void) listener;
 	struct wlr_output_layout_output *output_layout_output = data;
 	struct output *output = output_layout_output->output->data;
 
@@ -821,31 +2357,14 @@ void output_layout_add_notify(struct wl_listener *listener, void *data) {
 	wlr_scene_output_layout_add_output(server.scene_output_layout,
 					   output_layout_output, scene_output);
 
-	// move client[0] to this output if it's the first output
-	if (!output_first(true)) {
-		return;
-	}
-	if (wl_list_empty(&server.clients)) {
-		return;
-	}
-
-	(void) output;
-	// TODO
-	// move client[0] to this output
+	output_layout_schedule();
 }
 
 // FIXME remove? https://github.com/swaywm/sway/pull/8326
 void output_layout_change_notify(struct wl_listener *listener, void *data) {
 	(void) listener;
-	struct wlr_output_layout *output_layout = data;
-	struct wlr_box output_box = {0};
-	struct output *output;
-	wl_list_for_each (output, &server.outputs, link) {
-		wlr_output_layout_get_box(output_layout, output->wlr_output,
-					  &output_box);
-		output_set_box(output, output_box);
-	}
-	output_manager_send_config();
+	(void) data;
+	output_layout_schedule();
 }
 
 void output_layout_destroy_notify(struct wl_listener *listener, void *data) {
@@ -855,6 +2374,10 @@ void output_layout_destroy_notify(struct wl_listener *listener, void *data) {
 	wl_list_remove(&server.output_layout_add.link);
 	wl_list_remove(&server.output_layout_change.link);
 	wl_list_remove(&server.output_layout_destroy.link);
+	if (server.layout_idle) {
+		wl_event_source_remove(server.layout_idle);
+		server.layout_idle = NULL;
+	}
 }
 
 // emit: wlr_output_commit_state
@@ -869,8 +2392,329 @@ void output_commit_notify(struct wl_listener *listener, void *data) {
 		WLR_OUTPUT_STATE_ADAPTIVE_SYNC_ENABLED;
 
 	if (event->state->committed & flag) {
+		TRACE(TRACE_OUTPUT, output->wlr_output->width);
 		output_manager_send_config();
 	}
+	// a new mode may take adaptive sync where the old one did not
+	if (event->state->committed &
+	    (WLR_OUTPUT_STATE_MODE | WLR_OUTPUT_STATE_ENABLED)) {
+		output->vrr_failed = false;
+	}
+
+	struct client *client = output->current_client;
+	if (client && event->state->committed & WLR_OUTPUT_STATE_BUFFER) {
+		struct wlr_surface *surface =
+			client->xdg_toplevel->base->surface;
+		if (surface->buffer &&
+		    event->state->buffer == &surface->buffer->base) {
+			output->frames_scanout++;
+		}
+	}
+}
+
+// the nearest client tree above node, NULL for layers and borders
+struct client *output_node_client(struct wlr_scene_node *node) {
+	while (node) {
+		if (node->data) {
+			return node->data;
+		}
+		node = node->parent ? &node->parent->node : NULL;
+	}
+	return NULL;
+}
+
+struct output_frame_done {
+	struct output *output;
+	struct wlr_scene_output *scene_output;
+	struct timespec *when;
+};
+
+// only frames where the client gets a done for its toplevel surface
+void client_count_frame(struct client *client, struct wlr_surface *surface) {
+	if (surface == client->xdg_toplevel->base->surface &&
+	    !wl_list_empty(&surface->current.frame_callback_list)) {
+		client->frames++;
+	}
+}
+
+void output_frame_done_iter(struct wlr_scene_buffer *scene_buffer, int sx,
+			    int sy, void *data) {
+	struct output_frame_done *frame_done = data;
+	(void) sx;
+	(void) sy;
+
+	if (scene_buffer->primary_output != frame_done->scene_output) {
+		return;
+	}
+	struct wlr_scene_surface *scene_surface =
+		wlr_scene_surface_try_from_buffer(scene_buffer);
+	if (!scene_surface) {
+		return;
+	}
+	// monocle: the others are hidden behind current_client
+	struct client *client = output_node_client(&scene_buffer->node);
+	if (client && client != frame_done->output->current_client) {
+		return;
+	}
+	if (client) {
+		client_count_frame(client, scene_surface->surface);
+	}
+	wlr_surface_send_frame_done(scene_surface->surface, frame_done->when);
+}
+
+void client_frame_done_iter(struct wlr_surface *surface, int sx, int sy,
+			    void *data) {
+	(void) sx;
+	(void) sy;
+	wlr_surface_send_frame_done(surface, data);
+}
+
+void output_send_frame_done(struct output *output, struct timespec *when) {
+	// the live tree is hidden behind its snapshot, but the client may
+	// still wait on frame done before it acks the configure
+	struct client *client = output->current_client;
+	if (client && client->snapshot) {
+		client_count_frame(client, client->xdg_toplevel->base->surface);
+		wlr_xdg_surface_for_each_surface(client->xdg_toplevel->base,
+						 client_frame_done_iter, when);
+	}
+
+	struct output_frame_done frame_done = {
+		.output = output,
+		.scene_output = wlr_scene_get_scene_output(server.scene,
+							   output->wlr_output),
+		.when = when,
+	};
+	wlr_scene_output_for_each_buffer(frame_done.scene_output,
+					 output_frame_done_iter, &frame_done);
+}
+
+uint64_t output_refresh_ns(struct output *output) {
+	if (output->refresh_ns) {
+		return output->refresh_ns;
+	}
+	int refresh = output->wlr_output->refresh; // mHz
+	return refresh > 0 ? UINT64_C(1000000000000) / refresh : 0;
+}
+
+// the first vblank after now counted from the last present, 0 if unknown
+uint64_t output_next_vblank(struct output *output, uint64_t now) {
+	uint64_t period_ns = output_refresh_ns(output);
+	if (!output->present_ns || !period_ns || output->present_ns > now) {
+		return 0;
+	}
+	uint64_t periods = (now - output->present_ns) / period_ns + 1;
+	return output->present_ns + periods * period_ns;
+}
+
+// the fullscreen current client is all there is on the output, and it
+// asks for async presentation; anything on top of it means vsync
+bool output_tearing(struct output *output) {
+	struct client *client = output->current_client;
+	if (!client || !output->covered || client->snapshot) {
+		return false;
+	}
+	struct wlr_xdg_toplevel *xdg_toplevel = client->xdg_toplevel;
+	if (!xdg_toplevel->current.fullscreen ||
+	    !wl_list_empty(&xdg_toplevel->base->popups)) {
+		return false;
+	}
+	struct layer *layer;
+	wl_list_for_each (layer, &output->layer_surfaces, link) {
+		struct wlr_layer_surface_v1 *layer_surface =
+			layer->layer_surface;
+		if (layer_surface->surface->mapped &&
+		    layer_surface->current.layer >=
+			    ZWLR_LAYER_SHELL_V1_LAYER_TOP) {
+			return false;
+		}
+	}
+	return wlr_tearing_control_manager_v1_surface_hint_from_surface(
+		       server.tearing_control, xdg_toplevel->base->surface) ==
+	       WP_TEARING_CONTROL_V1_PRESENTATION_HINT_ASYNC;
+}
+
+// on its own, so the batch still waits for vblank
+bool output_commit_tearing(struct output *output,
+			   struct wlr_scene_output *scene_output) {
+	struct wlr_output *wlr_output = output->wlr_output;
+	struct wlr_output_state state;
+	wlr_output_state_init(&state);
+	bool ok = wlr_scene_output_build_state(scene_output, &state, NULL);
+	if (ok) {
+		state.tearing_page_flip = true;
+		if (!wlr_output_test_state(wlr_output, &state)) {
+			state.tearing_page_flip = false;
+		}
+		ok = wlr_output_commit_state(wlr_output, &state);
+	}
+	wlr_output_state_finish(&state);
+	return ok;
+}
+
+// all outputs whose frame came in the same event loop dispatch go to
+// the backend in one commit, so KMS can apply them atomically
+void output_frame_idle(void *data) {
+	(void) data;
+	server.frame_idle = NULL;
+	input_motion_flush();
+
+	struct wlr_backend_output_state *states =
+		calloc(wl_list_length(&server.outputs), sizeof(*states));
+	size_t states_len = 0;
+
+	// frame done carries the time it is sent, not a predicted vblank
+	uint64_t now = now_ns();
+	struct timespec when = {
+		.tv_sec = now / 1000000000,
+		.tv_nsec = now % 1000000000,
+	};
+
+	struct output *output;
+	wl_list_for_each (output, &server.outputs, link) {
+		if (!output->frame_pending) {
+			continue;
+		}
+		output->frame_pending = false;
+
+		struct wlr_scene_output *scene_output =
+			wlr_scene_get_scene_output(server.scene,
+						   output->wlr_output);
+		if (!scene_output || !output->wlr_output->enabled) {
+			continue;
+		}
+		if (!wlr_scene_output_needs_frame(scene_output)) {
+			TRACE(TRACE_FRAME, false);
+			output->frames_skipped++;
+			// clients waiting on frame callbacks have scheduled
+			// this frame, so they still get frame done
+			output_send_frame_done(output, &when);
+			continue;
+		}
+		if (output_tearing(output)) {
+			if (output_commit_tearing(output, scene_output)) {
+				TRACE(TRACE_FRAME, true);
+				output->frames_rendered++;
+			} else {
+				output->frames_skipped++;
+			}
+			output_send_frame_done(output, &when);
+			continue;
+		}
+
+		struct wlr_backend_output_state *backend_state =
+			&states[states_len++];
+		backend_state->output = output->wlr_output;
+		wlr_output_state_init(&backend_state->base);
+	}
+
+	if (states_len == 0) {
+		goto out;
+	}
+
+	uint64_t start_ns = now_ns();
+	bool is_ok = output_build_states(states, states_len, NULL) &&
+		     wlr_backend_commit(server.backend, states, states_len);
+	for (size_t i = 0; i < states_len; i++) {
+		wlr_output_state_finish(&states[i].base);
+	}
+
+	for (size_t i = 0; i < states_len; i++) {
+		struct wlr_output *wlr_output = states[i].output;
+		output = wlr_output->data;
+		bool committed = is_ok;
+		if (!committed) {
+			// heads that cannot go together, one by one
+			struct wlr_scene_output *scene_output =
+				wlr_scene_get_scene_output(server.scene,
+							   wlr_output);
+			committed = wlr_scene_output_commit(scene_output, NULL);
+		}
+		if (!committed) {
+			wlr_log(WLR_DEBUG, "[output] %s: commit failed",
+				wlr_output->name);
+			output->frames_skipped++;
+			output_send_frame_done(output, &when);
+			// nothing was rendered to time
+			states[i].output = NULL;
+			continue;
+		}
+		TRACE(TRACE_FRAME, true);
+		output->frames_rendered++;
+		output_send_frame_done(output, &when);
+	}
+
+	// the batch costs every output in it the same
+	uint64_t render_ns = now_ns() - start_ns;
+	for (size_t i = 0; i < states_len; i++) {
+		if (!states[i].output) {
+			continue;
+		}
+		output = states[i].output->data;
+		output->render_ns[output->render_idx++ %
+				  ARRAY_SIZE(output->render_ns)] = render_ns;
+	}
+
+out:
+	free(states);
+}
+
+void output_frame_queue(struct output *output) {
+	output->frame_pending = true;
+	if (!server.frame_idle) {
+		struct wl_event_loop *loop =
+			wl_display_get_event_loop(server.wl_display);
+		server.frame_idle =
+			wl_event_loop_add_idle(loop, output_frame_idle, NULL);
+	}
+}
+
+int output_pace_notify(int fd, uint32_t mask, void *data) {
+	struct output *output = data;
+	(void) mask;
+
+	uint64_t expirations;
+	if (read(fd, &expirations, sizeof(expirations)) < 0) {
+		return 0;
+	}
+	output_frame_queue(output);
+	return 0;
+}
+
+// when to render so it finishes config.frame_margin before the next
+// vblank, or 0 to render now
+uint64_t output_pace_deadline(struct output *output) {
+	uint64_t period_ns = output_refresh_ns(output);
+	if (config.frame_margin <= 0 || !period_ns || output->pace_fd < 0) {
+		return 0;
+	}
+	// async flips go out as soon as they are ready
+	if (output_tearing(output)) {
+		return 0;
+	}
+
+	// slowest of the recent renders
+	uint64_t render_ns = 0;
+	for (size_t i = 0; i < ARRAY_SIZE(output->render_ns); i++) {
+		if (output->render_ns[i] > render_ns) {
+			render_ns = output->render_ns[i];
+		}
+	}
+
+	uint64_t busy_ns = render_ns + (uint64_t) config.frame_margin * 1000;
+	if (busy_ns >= period_ns) {
+		return 0;
+	}
+
+	// frame comes right after vblank, so without a present event the
+	// next one is guessed a period away
+	uint64_t now = now_ns();
+	uint64_t vblank_ns = output_next_vblank(output, now);
+	if (!vblank_ns) {
+		vblank_ns = now + period_ns;
+	}
+	uint64_t deadline_ns = vblank_ns - busy_ns;
+	return deadline_ns > now ? deadline_ns : 0;
 }
 
 void output_frame_notify(struct wl_listener *listener, void *data) {
@@ -879,15 +2723,30 @@ void output_frame_notify(struct wl_listener *listener, void *data) {
 
 	assert(wlr_output->enabled);
 
-	struct wlr_scene_output *scene_output =
-		wlr_scene_get_scene_output(server.scene, wlr_output);
-
 	// FIXME check client_set_size
-	wlr_scene_output_commit(scene_output, NULL);
+	uint64_t deadline_ns = output_pace_deadline(output);
+	if (deadline_ns == 0) {
+		output_frame_queue(output);
+		return;
+	}
+	struct itimerspec spec = {
+		.it_value.tv_sec = deadline_ns / 1000000000,
+		.it_value.tv_nsec = deadline_ns % 1000000000,
+	};
+	timerfd_settime(output->pace_fd, TFD_TIMER_ABSTIME, &spec, NULL);
+}
 
-	struct timespec now = {0};
-	clock_gettime(CLOCK_MONOTONIC, &now);
-	wlr_scene_output_send_frame_done(scene_output, &now);
+// emit: wlr_output_send_present
+void output_present_notify(struct wl_listener *listener, void *data) {
+	struct output *output = wl_container_of(listener, output, present);
+	struct wlr_output_event_present *event = data;
+	if (!event->presented) {
+		return;
+	}
+	TRACE(TRACE_PRESENT, event->seq);
+	output->present_ns = (uint64_t) event->when.tv_sec * 1000000000 +
+			     event->when.tv_nsec;
+	output->refresh_ns = event->refresh > 0 ? event->refresh : 0;
 }
 
 // emit: wlr_output_send_request_state()
@@ -905,54 +2764,177 @@ void output_destroy(struct wl_listener *listener, void *data) {
 	struct output *output = wl_container_of(listener, output, destroy);
 	assert(output->wlr_output == data);
 
+	wlr_log(WLR_INFO,
+		"[output] %s frames: %" PRIu64 " rendered, %" PRIu64
+		" skipped, %" PRIu64 " scanout",
+		output_name(output), output->frames_rendered,
+		output->frames_skipped, output->frames_scanout);
+
+	// layer_destroy_notify unlinks them
+	struct layer *layer, *tmp;
+	wl_list_for_each_safe (layer, tmp, &output->layer_surfaces, link) {
+		wlr_layer_surface_v1_destroy(layer->layer_surface);
+	}
+	for (size_t i = 0; i < ARRAY_SIZE(output->layers); i++) {
+		wlr_scene_node_destroy(&output->layers[i]->node);
+	}
+	wlr_scene_node_destroy(&output->border->node);
+
+	// output_layout_arrange finds them a new output
+	if (output->current_client) {
+		client_hide(output->current_client);
+		output->current_client = NULL;
+	}
+	struct client *client;
+	wl_list_for_each (client, &server.clients, link) {
+		if (client->output == output) {
+			client->output = NULL;
+		}
+	}
+
+	wl_list_remove(&output->commit.link);
 	wl_list_remove(&output->frame.link);
+	wl_list_remove(&output->present.link);
 	wl_list_remove(&output->request_state.link);
 	wl_list_remove(&output->destroy.link);
 	wl_list_remove(&output->link);
 
+	if (output->pace_source) {
+		wl_event_source_remove(output->pace_source);
+	}
+	if (output->pace_fd >= 0) {
+		close(output->pace_fd);
+	}
+
 	wlr_output_layout_remove(server.output_layout, output->wlr_output);
 	free(output);
 }
 
+void output_update_vrr(struct output *output) {
+	struct wlr_output *wlr_output = output->wlr_output;
+	struct client *client = output->current_client;
+	bool enabled = client && client_wants_vrr(client);
+	bool current = wlr_output->adaptive_sync_status ==
+		       WLR_OUTPUT_ADAPTIVE_SYNC_ENABLED;
+	if (enabled == current || !wlr_output->enabled) {
+		return;
+	}
+	if (enabled && !wlr_output->adaptive_sync_supported) {
+		return;
+	}
+	// no retry on every commit of the same client
+	if (output->vrr_failed) {
+		return;
+	}
+
+	struct wlr_output_state state = {0};
+	wlr_output_state_init(&state);
+	wlr_output_state_set_adaptive_sync_enabled(&state, enabled);
+	bool is_ok = wlr_output_test_state(wlr_output, &state) &&
+		     wlr_output_commit_state(wlr_output, &state);
+	wlr_output_state_finish(&state);
+	output->vrr_failed = !is_ok;
+
+	wlr_log(WLR_DEBUG, "[output] %s adaptive sync %s%s",
+		output_name(output), enabled ? "on" : "off",
+		is_ok ? "" : " failed");
+}
+
 // only borders have color
 void output_set_color(struct output *output, const float color[static 4]) {
-	for (int i = 0; i < 4; i++) {
-		wlr_scene_rect_set_color(output->scene_border[i], color);
+	for (size_t i = 0; i < ARRAY_SIZE(output->border_rects); i++) {
+		wlr_scene_rect_set_color(output->border_rects[i], color);
 	}
 }
 
-void output_set_border(struct output *output, struct wlr_box *client_box) {
+// an opaque client hides the inside of one rect below it, grown by
+// padding, so only that node is damaged on a resize; anything else would
+// show through, so it gets the four edges: left, right, top, bottom
+//
+// no border for a client filling the output, and the scene is only
+// touched when border_box or opaque changes
+void output_set_border(struct output *output, const struct wlr_box *client_box,
+		       bool opaque) {
 	int padding = output->wlr_output->scale;
 	struct wlr_box border_box = {0};
 
-	if (!client_box || wlr_box_empty(client_box)) {
-		border_box = output->output_box;
-	} else {
+	if (client_box) {
 		border_box.x = client_box->x - padding;
 		border_box.y = client_box->y - padding;
 		border_box.width = client_box->width + padding * 2;
 		border_box.height = client_box->height + padding * 2;
 	}
+	if (wlr_box_equal(&border_box, &output->border_box) &&
+	    opaque == output->border_opaque) {
+		return;
+	}
+	output->border_box = border_box;
+	output->border_opaque = opaque;
 
-	wlr_scene_rect_set_size(output->scene_border[0], padding,
-				border_box.height);
-	wlr_scene_rect_set_size(output->scene_border[1], padding,
-				border_box.height);
-	wlr_scene_rect_set_size(output->scene_border[2],
-				border_box.width - padding * 2, padding);
-	wlr_scene_rect_set_size(output->scene_border[3],
-				border_box.width - padding * 2, padding);
+	struct wlr_scene_node *node = &output->border->node;
+	if (wlr_box_empty(&border_box)) {
+		wlr_scene_node_set_enabled(node, false);
+		return;
+	}
+	wlr_scene_node_set_position(node, border_box.x, border_box.y);
+	wlr_scene_node_set_enabled(node, true);
+
+	struct wlr_scene_rect **rects = output->border_rects;
+	int width = border_box.width, height = border_box.height;
+	for (size_t i = 1; i < ARRAY_SIZE(output->border_rects); i++) {
+		wlr_scene_node_set_enabled(&rects[i]->node, !opaque);
+	}
+	if (opaque) {
+		wlr_scene_rect_set_size(rects[0], width, height);
+		wlr_scene_node_set_position(&rects[0]->node, 0, 0);
+		return;
+	}
+	wlr_scene_rect_set_size(rects[0], padding, height);
+	wlr_scene_rect_set_size(rects[1], padding, height);
+	wlr_scene_rect_set_size(rects[2], width - padding * 2, padding);
+	wlr_scene_rect_set_size(rects[3], width - padding * 2, padding);
+	wlr_scene_node_set_position(&rects[0]->node, 0, 0);
+	wlr_scene_node_set_position(&rects[1]->node, width - padding, 0);
+	wlr_scene_node_set_position(&rects[2]->node, padding, 0);
+	wlr_scene_node_set_position(&rects[3]->node, padding,
+				    height - padding);
+}
 
-	wlr_scene_node_set_position(&output->scene_border[0]->node,
-				    border_box.x, border_box.y);
-	wlr_scene_node_set_position(&output->scene_border[1]->node,
-				    border_box.x + border_box.width - padding,
-				    border_box.y);
-	wlr_scene_node_set_position(&output->scene_border[2]->node,
-				    border_box.x + padding, border_box.y);
-	wlr_scene_node_set_position(&output->scene_border[3]->node,
-				    border_box.x + padding,
-				    border_box.y + border_box.height - padding);
+// wlr_scene_output_commit already tries direct scanout, but only when a
+// single buffer is left on the output, so drop the border when the
+// current client covers the whole output, and the background and bottom
+// layers when it is opaque too
+void output_update_scanout(struct output *output) {
+	struct client *client = output->current_client;
+	// a snapshot still shows the old size, wait for txn_apply
+	if (client && client->snapshot) {
+		return;
+	}
+
+	struct wlr_box client_box = {0};
+	bool covered = false;
+	bool opaque = false;
+	if (client && client->scene_tree) {
+		client_box = client->xdg_toplevel->base->geometry;
+		client_box.x = client->scene_tree->node.x;
+		client_box.y = client->scene_tree->node.y;
+		covered = wlr_box_equal(&client_box, &output->output_box);
+		opaque = client_opaque(client);
+	}
+
+	// nothing there would be seen, so no render and no frame done
+	for (int i = 0; i <= ZWLR_LAYER_SHELL_V1_LAYER_BOTTOM; i++) {
+		wlr_scene_node_set_enabled(&output->layers[i]->node,
+					   !(covered && opaque));
+	}
+	bool bordered = client && client->scene_tree && !covered;
+	output_set_border(output, bordered ? &client_box : NULL, opaque);
+
+	if (output->covered != covered) {
+		output->covered = covered;
+		wlr_log(WLR_DEBUG, "[output] %s direct scanout %s",
+			output_name(output), covered ? "on" : "off");
+	}
 }
 
 void new_output_notify(struct wl_listener *listener, void *data) {
@@ -988,6 +2970,9 @@ void new_output_notify(struct wl_listener *listener, void *data) {
 	output->frame.notify = output_frame_notify;
 	wl_signal_add(&wlr_output->events.frame, &output->frame);
 
+	output->present.notify = output_present_notify;
+	wl_signal_add(&wlr_output->events.present, &output->present);
+
 	output->request_state.notify = output_request_state_notify;
 	wl_signal_add(&wlr_output->events.request_state,
 		      &output->request_state);
@@ -995,24 +2980,750 @@ void new_output_notify(struct wl_listener *listener, void *data) {
 	output->destroy.notify = output_destroy;
 	wl_signal_add(&wlr_output->events.destroy, &output->destroy);
 
+	// pacing
+	// always, frame_margin may come with a reload
+	output->pace_fd =
+		timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+	if (output->pace_fd >= 0) {
+		output->pace_source = wl_event_loop_add_fd(
+			wl_display_get_event_loop(server.wl_display),
+			output->pace_fd, WL_EVENT_READABLE, output_pace_notify,
+			output);
+	}
+
+	// layer, before output_arrange runs from the layout
+	struct wlr_scene_tree *layer_parents[] = {
+		server.layer_background,
+		server.layer_bottom,
+		server.layer_top,
+		server.layer_overlay,
+	};
+	for (size_t i = 0; i < ARRAY_SIZE(output->layers); i++) {
+		output->layers[i] = wlr_scene_tree_create(layer_parents[i]);
+	}
+	wl_list_init(&output->layer_surfaces);
+
 	// layout, see output_layout_add_notify
 	wlr_output_layout_add_auto(server.output_layout, wlr_output);
 
-	// border
-	// TODO move this to output_layout_add_notify?
-	output->scene_tree = wlr_scene_tree_create(&server.scene->tree);
-	for (int i = 0; i < 4; i++) {
-		output->scene_border[i] = wlr_scene_rect_create(
-			output->scene_tree, 0, 0, config.color_nb);
+	// border, collapsed until output_update_scanout
+	// below clients already there, later ones are raised in client_show
+	output->border = wlr_scene_tree_create(server.layer_monocle);
+	wlr_scene_node_lower_to_bottom(&output->border->node);
+	wlr_scene_node_set_enabled(&output->border->node, false);
+	for (size_t i = 0; i < ARRAY_SIZE(output->border_rects); i++) {
+		output->border_rects[i] = wlr_scene_rect_create(
+			output->border, 0, 0, config.color_nb);
+	}
+}
+
+/// layer
+
+// emit: surface_handle_commit
+void layer_commit_notify(struct wl_listener *listener, void *data) {
+	struct layer *layer = wl_container_of(listener, layer, commit);
+	(void) data;
+
+	struct wlr_layer_surface_v1 *layer_surface = layer->layer_surface;
+	struct wlr_scene_tree *parent =
+		layer->output->layers[layer_surface->current.layer];
+	if (layer->scene->tree->node.parent != parent) {
+		wlr_scene_node_reparent(&layer->scene->tree->node, parent);
+	}
+
+	// the initial configure comes from output_arrange
+	if (!layer_surface->initial_commit &&
+	    !layer_surface->current.committed) {
+		return;
+	}
+	output_arrange(layer->output);
+	txn_commit();
+}
+
+// emit: wlr_surface_map
+void layer_map_notify(struct wl_listener *listener, void *data) {
+	struct layer *layer = wl_container_of(listener, layer, map);
+	(void) data;
+
+	// launchers and lock screens, on-demand ones are not handled yet
+	struct wlr_layer_surface_v1 *layer_surface = layer->layer_surface;
+	if (layer_surface->current.keyboard_interactive ==
+	    ZWLR_LAYER_SURFACE_V1_KEYBOARD_INTERACTIVITY_EXCLUSIVE) {
+		server.exclusive_layer = layer;
+		seat_keyboard_enter(layer_surface->surface);
+	}
+}
+
+// emit: wlr_surface_unmap
+void layer_unmap_notify(struct wl_listener *listener, void *data) {
+	struct layer *layer = wl_container_of(listener, layer, unmap);
+	(void) data;
+
+	if (server.exclusive_layer == layer) {
+		server.exclusive_layer = NULL;
+	}
+	// back to the focused client
+	struct wlr_surface *surface = layer->layer_surface->surface;
+	if (server.seat->keyboard_state.focused_surface == surface) {
+		struct wlr_surface *focus = NULL;
+		if (server.focus) {
+			focus = server.focus->xdg_toplevel->base->surface;
+		}
+		seat_keyboard_enter(focus);
 	}
+
+	// exclusive zone is given back
+	output_arrange(layer->output);
+	txn_commit();
+}
+
+void layer_destroy_notify(struct wl_listener *listener, void *data) {
+	struct layer *layer = wl_container_of(listener, layer, destroy);
+	(void) data;
+
+	wl_list_remove(&layer->commit.link);
+	wl_list_remove(&layer->map.link);
+	wl_list_remove(&layer->unmap.link);
+	wl_list_remove(&layer->new_popup.link);
+	wl_list_remove(&layer->destroy.link);
+	wl_list_remove(&layer->link);
+	if (server.exclusive_layer == layer) {
+		server.exclusive_layer = NULL;
+	}
+
+	free(layer);
+}
+
+// panel menus and the like, kept inside the output of their layer
+// surface on the initial commit
+void layer_popup_commit_notify(struct wl_listener *listener, void *data) {
+	struct layer_popup *popup = wl_container_of(listener, popup, commit);
+	(void) data;
+
+	if (!popup->xdg_popup->base->initial_commit) {
+		return;
+	}
+	// relative to the layer surface
+	int lx, ly;
+	wlr_scene_node_coords(&popup->layer->scene->tree->node, &lx, &ly);
+	struct wlr_box box = popup->layer->output->output_box;
+	box.x -= lx;
+	box.y -= ly;
+	wlr_xdg_popup_unconstrain_from_box(popup->xdg_popup, &box);
+	wlr_xdg_surface_schedule_configure(popup->xdg_popup->base);
+}
+
+void layer_popup_new_popup_notify(struct wl_listener *listener,
+				  void *data) {
+	struct layer_popup *popup =
+		wl_container_of(listener, popup, new_popup);
+	struct wlr_xdg_popup *xdg_popup = data;
+	layer_popup_create(popup->layer, xdg_popup,
+			   popup->xdg_popup->base->data);
+}
+
+void layer_popup_destroy_notify(struct wl_listener *listener, void *data) {
+	struct layer_popup *popup = wl_container_of(listener, popup, destroy);
+	(void) data;
+
+	wl_list_remove(&popup->commit.link);
+	wl_list_remove(&popup->new_popup.link);
+	wl_list_remove(&popup->destroy.link);
+	free(popup);
+}
+
+// parent is the scene tree of the layer surface or of the parent popup
+void layer_popup_create(struct layer *layer, struct wlr_xdg_popup *xdg_popup,
+			struct wlr_scene_tree *parent) {
+	struct wlr_scene_tree *tree =
+		wlr_scene_xdg_surface_create(parent, xdg_popup->base);
+	if (!tree) {
+		return;
+	}
+	xdg_popup->base->data = tree;
+
+	struct layer_popup *popup = calloc(1, sizeof(*popup));
+	popup->xdg_popup = xdg_popup;
+	popup->layer = layer;
+
+	popup->commit.notify = layer_popup_commit_notify;
+	wl_signal_add(&xdg_popup->base->surface->events.commit,
+		      &popup->commit);
+
+	popup->new_popup.notify = layer_popup_new_popup_notify;
+	wl_signal_add(&xdg_popup->base->events.new_popup, &popup->new_popup);
+
+	popup->destroy.notify = layer_popup_destroy_notify;
+	wl_signal_add(&xdg_popup->events.destroy, &popup->destroy);
+}
+
+void layer_new_popup_notify(struct wl_listener *listener, void *data) {
+	struct layer *layer = wl_container_of(listener, layer, new_popup);
+	struct wlr_xdg_popup *xdg_popup = data;
+	layer_popup_create(layer, xdg_popup, layer->scene->tree);
+}
+
+void new_layer_surface_notify(struct wl_listener *listener, void *data) {
+	(void) listener;
+	struct wlr_layer_surface_v1 *layer_surface = data;
+
+	if (!layer_surface->output) {
+		struct output *output = output_first(false);
+		if (!output) {
+			wlr_log(WLR_ERROR, "[layer] no output for %s",
+				layer_surface->namespace);
+			wlr_layer_surface_v1_destroy(layer_surface);
+			return;
+		}
+		layer_surface->output = output->wlr_output;
+	}
+	struct output *output = layer_surface->output->data;
+	wlr_log(WLR_DEBUG, "[layer] new %s on %s", layer_surface->namespace,
+		output_name(output));
+
+	struct layer *layer = calloc(1, sizeof(*layer));
+	layer->layer_surface = layer_surface;
+	layer->output = output;
+	layer->scene = wlr_scene_layer_surface_v1_create(
+		output->layers[layer_surface->pending.layer], layer_surface);
+	wl_list_insert(&output->layer_surfaces, &layer->link);
+
+	layer->commit.notify = layer_commit_notify;
+	wl_signal_add(&layer_surface->surface->events.commit, &layer->commit);
+
+	layer->map.notify = layer_map_notify;
+	wl_signal_add(&layer_surface->surface->events.map, &layer->map);
+
+	layer->unmap.notify = layer_unmap_notify;
+	wl_signal_add(&layer_surface->surface->events.unmap, &layer->unmap);
+
+	layer->new_popup.notify = layer_new_popup_notify;
+	wl_signal_add(&layer_surface->events.new_popup, &layer->new_popup);
+
+	layer->destroy.notify = layer_destroy_notify;
+	wl_signal_add(&layer_surface->events.destroy, &layer->destroy);
+}
+
+/// input
+
+// keys go through keymap_lookup before the client sees them, pointer
+// motion moves the cursor right away but reaches clients once per output
+// frame, and relative motion is passed on as it comes for games
+
+void keyboard_modifiers_notify(struct wl_listener *listener, void *data) {
+	struct keyboard *keyboard =
+		wl_container_of(listener, keyboard, modifiers);
+	(void) data;
+	wlr_seat_set_keyboard(server.seat, keyboard->wlr_keyboard);
+	wlr_seat_keyboard_notify_modifiers(server.seat,
+					   &keyboard->wlr_keyboard->modifiers);
+}
+
+void keyboard_key_notify(struct wl_listener *listener, void *data) {
+	struct keyboard *keyboard = wl_container_of(listener, keyboard, key);
+	struct wlr_keyboard_key_event *event = data;
+	struct wlr_keyboard *wlr_keyboard = keyboard->wlr_keyboard;
+
+	if (event->state == WL_KEYBOARD_KEY_STATE_RELEASED) {
+		int i = keyboard_consumed(keyboard, event->keycode);
+		if (i >= 0) {
+			keyboard->consumed[i] =
+				keyboard->consumed[--keyboard->consumed_len];
+			return;
+		}
+	}
+
+	// an exclusive layer surface, e.g. a lock screen, gets every key
+	if (event->state == WL_KEYBOARD_KEY_STATE_PRESSED &&
+	    !server.exclusive_layer) {
+		// level 0, keys in wlessrc are lowercase
+		xkb_keycode_t keycode = event->keycode + 8;
+		xkb_layout_index_t layout = xkb_state_key_get_layout(
+			wlr_keyboard->xkb_state, keycode);
+		const xkb_keysym_t *syms;
+		int syms_len = xkb_keymap_key_get_syms_by_level(
+			wlr_keyboard->keymap, keycode, layout, 0, &syms);
+		// locks would break every keybinding while they are on
+		uint32_t modifiers = wlr_keyboard_get_modifiers(wlr_keyboard) &
+				     ~(WLR_MODIFIER_CAPS | WLR_MODIFIER_MOD2);
+		for (int i = 0; i < syms_len; i++) {
+			struct key *key = keymap_lookup(modifiers, syms[i]);
+			if (!key) {
+				continue;
+			}
+			TRACE(TRACE_KEY, syms[i]);
+			if (keyboard->consumed_len <
+			    ARRAY_SIZE(keyboard->consumed)) {
+				keyboard->consumed[keyboard->consumed_len++] =
+					event->keycode;
+			}
+			key->run(key->arg);
+			return;
+		}
+	}
+
+	wlr_seat_set_keyboard(server.seat, wlr_keyboard);
+	wlr_seat_keyboard_notify_key(server.seat, event->time_msec,
+				     event->keycode, event->state);
+}
+
+void input_update_caps(void) {
+	uint32_t caps = WL_SEAT_CAPABILITY_POINTER;
+	if (!wl_list_empty(&server.keyboards)) {
+		caps |= WL_SEAT_CAPABILITY_KEYBOARD;
+	}
+	wlr_seat_set_capabilities(server.seat, caps);
+}
+
+void keyboard_destroy_notify(struct wl_listener *listener, void *data) {
+	struct keyboard *keyboard =
+		wl_container_of(listener, keyboard, destroy);
+	(void) data;
+
+	wl_list_remove(&keyboard->modifiers.link);
+	wl_list_remove(&keyboard->key.link);
+	wl_list_remove(&keyboard->destroy.link);
+	wl_list_remove(&keyboard->link);
+	free(keyboard);
+
+	input_update_caps();
+}
+
+void input_new_keyboard(struct wlr_input_device *device) {
+	struct wlr_keyboard *wlr_keyboard =
+		wlr_keyboard_from_input_device(device);
+
+	// XKB_DEFAULT_LAYOUT and friends
+	struct xkb_context *context = xkb_context_new(XKB_CONTEXT_NO_FLAGS);
+	struct xkb_keymap *keymap = xkb_keymap_new_from_names(
+		context, NULL, XKB_KEYMAP_COMPILE_NO_FLAGS);
+	wlr_keyboard_set_keymap(wlr_keyboard, keymap);
+	xkb_keymap_unref(keymap);
+	xkb_context_unref(context);
+	wlr_keyboard_set_repeat_info(wlr_keyboard, 25, 600);
+
+	struct keyboard *keyboard = calloc(1, sizeof(*keyboard));
+	keyboard->wlr_keyboard = wlr_keyboard;
+	wlr_keyboard->data = keyboard;
+
+	keyboard->modifiers.notify = keyboard_modifiers_notify;
+	wl_signal_add(&wlr_keyboard->events.modifiers, &keyboard->modifiers);
+
+	keyboard->key.notify = keyboard_key_notify;
+	wl_signal_add(&wlr_keyboard->events.key, &keyboard->key);
+
+	keyboard->destroy.notify = keyboard_destroy_notify;
+	wl_signal_add(&device->events.destroy, &keyboard->destroy);
+
+	wlr_seat_set_keyboard(server.seat, wlr_keyboard);
+	wl_list_insert(&server.keyboards, &keyboard->link);
+}
+
+void new_input_notify(struct wl_listener *listener, void *data) {
+	(void) listener;
+	struct wlr_input_device *device = data;
+
+	wlr_log(WLR_INFO, "[input] new_input: %s", device->name);
+	switch (device->type) {
+	case WLR_INPUT_DEVICE_KEYBOARD:
+		input_new_keyboard(device);
+		break;
+	case WLR_INPUT_DEVICE_POINTER:
+		wlr_cursor_attach_input_device(server.cursor, device);
+		break;
+	default:
+		break;
+	}
+	input_update_caps();
+}
+
+struct wlr_surface *input_surface_at(double lx, double ly, double *sx,
+				     double *sy) {
+	struct wlr_scene_node *node =
+		wlr_scene_node_at(&server.scene->tree.node, lx, ly, sx, sy);
+	if (!node || node->type != WLR_SCENE_NODE_BUFFER) {
+		return NULL;
+	}
+	// snapshots have no surface
+	struct wlr_scene_surface *scene_surface =
+		wlr_scene_surface_try_from_buffer(
+			wlr_scene_buffer_from_node(node));
+	return scene_surface ? scene_surface->surface : NULL;
+}
+
+// once per output frame however fast the mouse polls, and before any
+// button or axis event so they land where the pointer is
+void input_motion_flush(void) {
+	if (!server.motion_pending) {
+		return;
+	}
+	server.motion_pending = false;
+
+	double sx, sy;
+	struct wlr_surface *surface =
+		input_surface_at(server.cursor->x, server.cursor->y, &sx, &sy);
+	if (!surface) {
+		if (server.seat->pointer_state.focused_surface) {
+			wlr_seat_pointer_clear_focus(server.seat);
+			wlr_cursor_set_xcursor(server.cursor,
+					       server.xcursor_manager,
+					       "default");
+		}
+	} else {
+		wlr_seat_pointer_notify_enter(server.seat, surface, sx, sy);
+		wlr_seat_pointer_notify_motion(server.seat, server.motion_time,
+					       sx, sy);
+	}
+	wlr_seat_pointer_notify_frame(server.seat);
+}
+
+// the next frame of the output under the cursor flushes it
+void input_motion_queue(uint32_t time_msec) {
+	server.motion_time = time_msec;
+	if (server.motion_pending) {
+		return;
+	}
+	server.motion_pending = true;
+
+	struct wlr_output *wlr_output = wlr_output_layout_output_at(
+		server.output_layout, server.cursor->x, server.cursor->y);
+	if (!wlr_output || !wlr_output->enabled) {
+		input_motion_flush();
+		return;
+	}
+	wlr_output_schedule_frame(wlr_output);
+}
+
+void cursor_motion_notify(struct wl_listener *listener, void *data) {
+	(void) listener;
+	struct wlr_pointer_motion_event *event = data;
+
+	wlr_cursor_move(server.cursor, &event->pointer->base, event->delta_x,
+			event->delta_y);
+	wlr_relative_pointer_manager_v1_send_relative_motion(
+		server.relative_pointer_manager, server.seat,
+		(uint64_t) event->time_msec * 1000, event->delta_x,
+		event->delta_y, event->unaccel_dx, event->unaccel_dy);
+	input_motion_queue(event->time_msec);
+}
+
+void cursor_motion_absolute_notify(struct wl_listener *listener,
+				   void *data) {
+	(void) listener;
+	struct wlr_pointer_motion_absolute_event *event = data;
+
+	wlr_cursor_warp_absolute(server.cursor, &event->pointer->base,
+				 event->x, event->y);
+	input_motion_queue(event->time_msec);
+}
+
+void cursor_button_notify(struct wl_listener *listener, void *data) {
+	(void) listener;
+	struct wlr_pointer_button_event *event = data;
+
+	input_motion_flush();
+	struct wlr_surface *surface =
+		server.seat->pointer_state.focused_surface;
+	if (surface && event->state == WL_POINTER_BUTTON_STATE_PRESSED) {
+		surface = wlr_surface_get_root_surface(surface);
+		struct client *client = client_from_surface(surface);
+		if (client && client_output(client)) {
+			client_focus(client);
+		}
+	}
+	wlr_seat_pointer_notify_button(server.seat, event->time_msec,
+				       event->button, event->state);
+}
+
+void cursor_axis_notify(struct wl_listener *listener, void *data) {
+	(void) listener;
+	struct wlr_pointer_axis_event *event = data;
+
+	input_motion_flush();
+	wlr_seat_pointer_notify_axis(server.seat, event->time_msec,
+				     event->orientation, event->delta,
+				     event->delta_discrete, event->source,
+				     event->relative_direction);
+}
+
+// input_motion_flush sends its own
+void cursor_frame_notify(struct wl_listener *listener, void *data) {
+	(void) listener;
+	(void) data;
+	if (!server.motion_pending) {
+		wlr_seat_pointer_notify_frame(server.seat);
+	}
+}
+
+void request_set_cursor_notify(struct wl_listener *listener, void *data) {
+	(void) listener;
+	struct wlr_seat_pointer_request_set_cursor_event *event = data;
+	struct wlr_seat_client *focused_client =
+		server.seat->pointer_state.focused_client;
+	if (focused_client != event->seat_client) {
+		return;
+	}
+	wlr_cursor_set_surface(server.cursor, event->surface,
+			       event->hotspot_x, event->hotspot_y);
+}
+
+void request_set_selection_notify(struct wl_listener *listener,
+				  void *data) {
+	(void) listener;
+	struct wlr_seat_request_set_selection_event *event = data;
+	wlr_seat_set_selection(server.seat, event->source, event->serial);
+}
+
+/// reload
+
+// file and cli are parsed again, and only what changed is applied
+
+void reload_config(void) {
+	wlr_log(WLR_INFO, "[reload] %s", config.path);
+
+	struct key *key, *tmp;
+	wl_list_for_each (key, &config.keybings, link) {
+		key->stale = true;
+	}
+	memset(config.color_bg, 0, sizeof(config.color_bg));
+	memset(config.color_fb, 0, sizeof(config.color_fb));
+	memset(config.color_nb, 0, sizeof(config.color_nb));
+	config.frame_margin = 0;
+	config.vrr = VRR_OFF;
+
+	config.reloading = true;
+	int fargc;
+	char **fargv;
+	opt_list_from_file(config.path, &fargc, &fargv, NULL);
+	opt_getopt_one(fargc, fargv, true);
+	opt_list_free(fargc, fargv);
+	opt_getopt_one(config.argc, config.argv, false);
+	config.reloading = false;
+
+	opt_hex_color("242424", config.color_bg);
+	opt_hex_color("24acd4", config.color_fb);
+	opt_hex_color("616161", config.color_nb);
+
+	wl_list_for_each_safe (key, tmp, &config.keybings, link) {
+		if (!key->stale) {
+			continue;
+		}
+		wlr_log(WLR_DEBUG, "[reload] remove key %s", key->command);
+		keymap_remove(key);
+		wl_list_remove(&key->link);
+		free(key->command);
+		free(key);
+	}
+	keymap_reset_masks();
+
+	// scene nodes stay, only their colors change
+	struct output *output;
+	wl_list_for_each (output, &server.outputs, link) {
+		bool focused = server.focus && server.focus->output == output;
+		output_set_color(output,
+				 focused ? config.color_fb : config.color_nb);
+		output_update_vrr(output);
+	}
+}
+
+int reload_notify(int fd, uint32_t mask, void *data) {
+	(void) mask;
+	(void) data;
+
+	_Alignas(struct inotify_event) char buf[4096];
+	char *path = strdup(config.path);
+	const char *name = basename(path);
+	bool changed = false;
+
+	ssize_t len;
+	while ((len = read(fd, buf, sizeof(buf))) > 0) {
+		char *ptr = buf;
+		while (ptr < buf + len) {
+			const struct inotify_event *event = (const void *) ptr;
+			if (event->len && strcmp(event->name, name) == 0) {
+				changed = true;
+			}
+			ptr += sizeof(*event) + event->len;
+		}
+	}
+	free(path);
+
+	// a batch of writes or an editor's rename, reload once
+	if (changed) {
+		reload_config();
+	}
+	return 0;
+}
+
+// watch the directory, editors often replace the file and a missing
+// one may be created later; events are filtered by the basename of the
+// config in reload_notify
+void reload_init(struct wl_event_loop *loop) {
+	struct stat st;
+	if (stat(config.path, &st) == 0 && !S_ISREG(st.st_mode)) {
+		wlr_log(WLR_INFO, "[reload] %s is not a file, not watched",
+			config.path);
+		return;
+	}
+	int fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (fd < 0) {
+		wlr_log_errno(WLR_ERROR, "[reload] inotify_init1");
+		return;
+	}
+	char *path = strdup(config.path);
+	const char *dir = dirname(path);
+	if (inotify_add_watch(fd, dir, IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+		wlr_log_errno(WLR_ERROR, "[reload] failed to watch %s", dir);
+		close(fd);
+	} else {
+		wl_event_loop_add_fd(loop, fd, WL_EVENT_READABLE, reload_notify,
+				     NULL);
+	}
+	free(path);
+}
+
+/// command
+
+// cmd= of a keybinding is resolved once in opt_key_set, builtins run in
+// place and anything else goes to spawn_cmd as it is
+
+// the one with the focused client
+struct output *command_output(void) {
+	if (server.focus && server.focus->output) {
+		return server.focus->output;
+	}
+	return output_first(false);
+}
+
+// the next usable one, or output itself
+struct output *command_output_next(struct output *output) {
+	struct wl_list *link = &output->link;
+	do {
+		link = link->next;
+		if (link == &server.outputs) {
+			continue;
+		}
+		struct output *next = wl_container_of(link, next, link);
+		if (output_usable(next)) {
+			return next;
+		}
+	} while (link != &output->link);
+	return output;
+}
+
+void command_switch(const char *arg) {
+	(void) arg;
+	struct output *output = command_output();
+	if (output) {
+		client_switch(output);
+	}
+}
+
+void command_focus_next(const char *arg) {
+	(void) arg;
+	struct output *output = command_output();
+	if (!output) {
+		return;
+	}
+	struct output *next = command_output_next(output);
+	if (next->current_client) {
+		client_focus(next->current_client);
+	}
+}
+
+void command_fullscreen(const char *arg) {
+	(void) arg;
+	struct client *client = server.focus;
+	if (!client) {
+		return;
+	}
+	struct wlr_xdg_toplevel *xdg_toplevel = client->xdg_toplevel;
+	wlr_xdg_toplevel_set_fullscreen(xdg_toplevel,
+					!xdg_toplevel->scheduled.fullscreen);
+}
+
+// the output left behind shows the next free client
+void command_move_to_output(const char *arg) {
+	(void) arg;
+	struct client *client = server.focus;
+	if (!client) {
+		return;
+	}
+	struct output *output = client->output;
+	struct output *next = command_output_next(output);
+	if (next == output) {
+		return;
+	}
+	client_show(output, client_first(true));
+	client_show(next, client);
+}
+
+void command_reload(const char *arg) {
+	(void) arg;
+	reload_config();
+}
+
+void command_quit(const char *arg) {
+	(void) arg;
+	wl_display_terminate(server.wl_display);
+}
+
+void command_spawn(const char *arg) {
+	if (*arg) {
+		spawn_cmd(arg);
+	}
+}
+
+// "jump foot foot" shows the last foot, or spawns one if there is none;
+// REGEX has no blanks
+void command_jump(const char *arg) {
+	size_t len = strcspn(arg, " \t");
+	const char *cmd = arg + len + strspn(arg + len, " \t");
+	regex_t *regex = len ? jump_regex(arg, len) : NULL;
+	struct client *client = regex ? jump_client(regex) : NULL;
+	if (client) {
+		client_activate(client);
+	} else {
+		command_spawn(cmd);
+	}
+}
+
+struct command {
+	const char *name;
+	void (*run)(const char *arg);
+};
+
+const struct command commands[] = {
+	{"switch", command_switch},
+	{"focus-next", command_focus_next},
+	{"fullscreen", command_fullscreen},
+	{"move-to-output", command_move_to_output},
+	{"reload", command_reload},
+	{"quit", command_quit},
+	{"spawn", command_spawn},
+	{"jump", command_jump},
+};
+
+// "spawn foot" runs command_spawn with "foot"
+void command_resolve(struct key *key) {
+	const char *command = key->command;
+	size_t len = strcspn(command, " \t");
+	for (size_t i = 0; i < ARRAY_SIZE(commands); i++) {
+		if (strlen(commands[i].name) == len &&
+		    strncmp(commands[i].name, command, len) == 0) {
+			key->run = commands[i].run;
+			key->arg = command + len + strspn(command + len, " \t");
+			return;
+		}
+	}
+	key->run = command_spawn;
+	key->arg = command;
 }
 
 /// main
 int main(int argc, char **argv) {
 	opt_getopt_all(argc, argv);
 
-	return 0;
-
 	server.wl_display = wl_display_create();
 	if (!server.wl_display) {
 		wlr_log(WLR_ERROR, "[init] failed to create wl_display");
@@ -1032,8 +3743,21 @@ int main(int argc, char **argv) {
 		goto err_create_renderer;
 	}
 
-	// FIXME safe
-	wlr_renderer_init_wl_display(server.renderer, server.wl_display);
+	// what wlr_renderer_init_wl_display does, but the dmabuf global is
+	// kept for the scene, see wlr_scene_set_linux_dmabuf_v1
+	if (!wlr_renderer_init_wl_shm(server.renderer, server.wl_display)) {
+		wlr_log(WLR_ERROR, "[init] failed to create wl_shm");
+		goto err_create_allocator;
+	}
+	int drm_fd = wlr_renderer_get_drm_fd(server.renderer);
+	if (wlr_renderer_get_texture_formats(server.renderer,
+					     WLR_BUFFER_CAP_DMABUF)) {
+		if (drm_fd >= 0) {
+			wlr_drm_create(server.wl_display, server.renderer);
+		}
+		server.linux_dmabuf = wlr_linux_dmabuf_v1_create_with_renderer(
+			server.wl_display, 4, server.renderer);
+	}
 
 	server.allocator =
 		wlr_allocator_autocreate(server.backend, server.renderer);
@@ -1042,6 +3766,10 @@ int main(int argc, char **argv) {
 		goto err_create_allocator;
 	}
 
+	trace_init(wl_display_get_event_loop(server.wl_display));
+	spawn_init(wl_display_get_event_loop(server.wl_display));
+	reload_init(wl_display_get_event_loop(server.wl_display));
+
 	// output
 	wl_list_init(&server.outputs);
 	server.new_output.notify = new_output_notify;
@@ -1059,6 +3787,19 @@ int main(int argc, char **argv) {
 		      &server.output_layout_destroy);
 
 	server.scene = wlr_scene_create();
+	// per surface feedback with a scanout tranche for the output a
+	// client buffer could go to directly, updated as clients switch and
+	// outputs change
+	if (server.linux_dmabuf) {
+		wlr_scene_set_linux_dmabuf_v1(server.scene,
+					      server.linux_dmabuf);
+	}
+	// bottom to top
+	server.layer_background = wlr_scene_tree_create(&server.scene->tree);
+	server.layer_bottom = wlr_scene_tree_create(&server.scene->tree);
+	server.layer_monocle = wlr_scene_tree_create(&server.scene->tree);
+	server.layer_top = wlr_scene_tree_create(&server.scene->tree);
+	server.layer_overlay = wlr_scene_tree_create(&server.scene->tree);
 	server.scene_output_layout = wlr_scene_attach_output_layout(
 		server.scene, server.output_layout);
 
@@ -1076,7 +3817,11 @@ int main(int argc, char **argv) {
 
 	// client
 	wl_list_init(&server.clients);
-	server.xdg_shell = wlr_xdg_shell_create(server.wl_display, 3);
+	server.txn_timer = wl_event_loop_add_timer(
+		wl_display_get_event_loop(server.wl_display), txn_timeout,
+		NULL);
+	// 6 for suspended
+	server.xdg_shell = wlr_xdg_shell_create(server.wl_display, 6);
 	server.new_xdg_toplevel.notify = new_xdg_toplevel_notify;
 	wl_signal_add(&server.xdg_shell->events.new_toplevel,
 		      &server.new_xdg_toplevel);
@@ -1084,27 +3829,108 @@ int main(int argc, char **argv) {
 	// wl_display_add_destroy_listener
 	wlr_compositor_create(server.wl_display, 5, server.renderer);
 	wlr_subcompositor_create(server.wl_display);
+	server.tearing_control =
+		wlr_tearing_control_manager_v1_create(server.wl_display, 1);
+	// feedback is sent by the scene, with zero-copy for direct scanout
+	wlr_presentation_create(server.wl_display, server.backend, 2);
+
+	// explicit sync, acquire and release points are handled by
+	// wlr_scene_output_build_state in output_frame_idle and
+	// output_manager_update
+	if (drm_fd >= 0 && server.renderer->features.timeline &&
+	    server.backend->features.timeline) {
+		wlr_linux_drm_syncobj_manager_v1_create(server.wl_display, 1,
+							drm_fd);
+	} else {
+		wlr_log(WLR_INFO, "[init] no timeline, implicit sync only");
+	}
 	wlr_data_device_manager_create(server.wl_display);
+	server.content_type_manager =
+		wlr_content_type_manager_v1_create(server.wl_display, 1);
+
+	// layer
+	server.layer_shell = wlr_layer_shell_v1_create(server.wl_display, 4);
+	server.new_layer_surface.notify = new_layer_surface_notify;
+	wl_signal_add(&server.layer_shell->events.new_surface,
+		      &server.new_layer_surface);
+
+	// activation
+	server.foreign_toplevel_list =
+		wlr_ext_foreign_toplevel_list_v1_create(server.wl_display, 1);
+	server.xdg_activation = wlr_xdg_activation_v1_create(server.wl_display);
+	server.request_activate.notify = request_activate_notify;
+	wl_signal_add(&server.xdg_activation->events.request_activate,
+		      &server.request_activate);
+	wl_list_init(&server.jumps);
+	server.new_token.notify = new_token_notify;
+	wl_signal_add(&server.xdg_activation->events.new_token,
+		      &server.new_token);
+
+	// input
+	server.seat = wlr_seat_create(server.wl_display, "seat0");
+	wl_list_init(&server.keyboards);
+	server.new_input.notify = new_input_notify;
+	wl_signal_add(&server.backend->events.new_input, &server.new_input);
+	server.request_set_cursor.notify = request_set_cursor_notify;
+	wl_signal_add(&server.seat->events.request_set_cursor,
+		      &server.request_set_cursor);
+	server.request_set_selection.notify = request_set_selection_notify;
+	wl_signal_add(&server.seat->events.request_set_selection,
+		      &server.request_set_selection);
+
+	server.cursor = wlr_cursor_create();
+	wlr_cursor_attach_output_layout(server.cursor, server.output_layout);
+	server.xcursor_manager = wlr_xcursor_manager_create(NULL, 24);
+	wlr_cursor_set_xcursor(server.cursor, server.xcursor_manager,
+			       "default");
+	server.cursor_motion.notify = cursor_motion_notify;
+	wl_signal_add(&server.cursor->events.motion, &server.cursor_motion);
+	server.cursor_motion_absolute.notify = cursor_motion_absolute_notify;
+	wl_signal_add(&server.cursor->events.motion_absolute,
+		      &server.cursor_motion_absolute);
+	server.cursor_button.notify = cursor_button_notify;
+	wl_signal_add(&server.cursor->events.button, &server.cursor_button);
+	server.cursor_axis.notify = cursor_axis_notify;
+	wl_signal_add(&server.cursor->events.axis, &server.cursor_axis);
+	server.cursor_frame.notify = cursor_frame_notify;
+	wl_signal_add(&server.cursor->events.frame, &server.cursor_frame);
+	server.relative_pointer_manager =
+		wlr_relative_pointer_manager_v1_create(server.wl_display);
+
+	// capture
+	// export-dmabuf hands out the buffer that went to the output, which
+	// is the client buffer itself under direct scanout; the copying ones
+	// ask for a frame through output->needs_frame and copy damage only
+	wlr_export_dmabuf_manager_v1_create(server.wl_display);
+	wlr_screencopy_manager_v1_create(server.wl_display);
+	wlr_ext_image_copy_capture_manager_v1_create(server.wl_display, 1);
+	wlr_ext_output_image_capture_source_manager_v1_create(
+		server.wl_display, 1);
 
 	// FIXME
 
 	const char *socket = wl_display_add_socket_auto(server.wl_display);
 	if (!socket) {
+		wlr_log(WLR_ERROR, "[init] failed to add wayland socket");
+		goto err_start;
 	}
 	if (!wlr_backend_start(server.backend)) {
+		wlr_log(WLR_ERROR, "[init] failed to start wlr_backend");
+		goto err_start;
 	}
 
 	setenv("WAYLAND_DISPLAY", socket, true);
 
 	char **start_cmd;
 	wl_array_for_each(start_cmd, &config.start_cmd) {
-		opt_exec_cmd(*start_cmd);
+		spawn_cmd(*start_cmd);
 	}
 
 	wl_display_run(server.wl_display);
 
 	exit(EXIT_SUCCESS);
 
+err_start:
 	wlr_allocator_destroy(server.allocator);
 err_create_allocator:
 	wlr_renderer_destroy(server.renderer);
@@ -0,0 +1,797 @@
+#include "presentation-time-client-protocol.h"
+#include "wlr-layer-shell-unstable-v1-client-protocol.h"
+#include "xdg-shell-client-protocol.h"
+#include <fcntl.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#include <wayland-client.h>
+
+// wless-bench -w WLESS [-n CLIENTS] [-r ROUNDS]
+//
+// parent: start wless on the headless backend with the pixman renderer,
+// and let wless spawn this binary again as the driver (-c) with start-cmd
+//
+// driver: fork N - 1 client processes that map one xdg_toplevel each, map
+// the last one itself, then resize it by flipping the exclusive zone of a
+// layer-shell panel; latency is commit to wp_presentation feedback, and
+// the parent adds compositor cpu time
+
+#define USAGE "wless-bench -w WLESS [-n CLIENTS] [-r ROUNDS]\n"
+#define TIMEOUT_MS 5000
+#define PANEL_HEIGHT 32
+
+struct window {
+	struct wl_surface *surface;
+	struct xdg_surface *xdg_surface;
+	struct xdg_toplevel *xdg_toplevel;
+	struct wl_buffer *buffer;
+	int32_t buffer_width, buffer_height;
+
+	// from the last configure, drawn on the next window_draw
+	int32_t width, height;
+	uint32_t serial;
+};
+
+struct panel {
+	struct wl_surface *surface;
+	struct zwlr_layer_surface_v1 *layer_surface;
+	struct wl_buffer *buffer;
+	uint32_t width, height;
+	bool configured;
+};
+
+struct samples {
+	const char *name;
+	uint64_t *ns;
+	size_t len, cap;
+};
+
+struct bench {
+	int clients;
+	int rounds;
+	int report_fd;
+
+	struct wl_display *display;
+	struct wl_compositor *compositor;
+	struct wl_shm *shm;
+	struct xdg_wm_base *wm_base;
+	struct wp_presentation *presentation;
+	struct zwlr_layer_shell_v1 *layer_shell;
+	clockid_t clock_id; // of presentation timestamps
+
+	uint64_t present_ns; // of the last feedback, 0 if discarded
+	bool feedback_done;
+	uint64_t frames;
+} bench = {
+	.clients = 4,
+	.rounds = 100,
+	.report_fd = -1,
+	.clock_id = CLOCK_MONOTONIC,
+};
+
+uint64_t now_ns(void) {
+	struct timespec ts;
+	clock_gettime(bench.clock_id, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/// samples
+
+void samples_add(struct samples *samples, uint64_t ns) {
+	if (samples->len == samples->cap) {
+		samples->cap = samples->cap ? samples->cap * 2 : 256;
+		samples->ns = realloc(samples->ns,
+				      samples->cap * sizeof(*samples->ns));
+	}
+	samples->ns[samples->len++] = ns;
+}
+
+int samples_cmp(const void *a, const void *b) {
+	uint64_t x = *(const uint64_t *) a, y = *(const uint64_t *) b;
+	return (x > y) - (x < y);
+}
+
+void samples_report(struct samples *samples) {
+	if (samples->len == 0) {
+		fprintf(stdout, "%-8s n=0\n", samples->name);
+		return;
+	}
+	qsort(samples->ns, samples->len, sizeof(*samples->ns), samples_cmp);
+	uint64_t p50 = samples->ns[samples->len * 50 / 100];
+	uint64_t p99 = samples->ns[samples->len * 99 / 100];
+	fprintf(stdout, "%-8s n=%zu p50=%.3fms p99=%.3fms\n", samples->name,
+		samples->len, p50 / 1e6, p99 / 1e6);
+}
+
+/// client
+
+struct wl_buffer *shm_buffer_create(int32_t width, int32_t height,
+				    uint32_t color) {
+	int32_t stride = width * 4;
+	size_t size = (size_t) stride * height;
+
+	char name[64];
+	snprintf(name, sizeof(name), "/wless-bench-%d", getpid());
+	int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+	if (fd < 0) {
+		return NULL;
+	}
+	shm_unlink(name);
+	if (ftruncate(fd, size) < 0) {
+		close(fd);
+		return NULL;
+	}
+
+	uint32_t *data =
+		mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (data == MAP_FAILED) {
+		close(fd);
+		return NULL;
+	}
+	for (size_t i = 0; i < size / 4; i++) {
+		data[i] = color;
+	}
+	munmap(data, size);
+
+	struct wl_shm_pool *pool = wl_shm_create_pool(bench.shm, fd, size);
+	struct wl_buffer *buffer = wl_shm_pool_create_buffer(
+		pool, 0, width, height, stride, WL_SHM_FORMAT_XRGB8888);
+	wl_shm_pool_destroy(pool);
+	close(fd);
+	return buffer;
+}
+
+void feedback_sync_output(void *data,
+			  struct wp_presentation_feedback *feedback,
+			  struct wl_output *output) {
+	(void) data;
+	(void) feedback;
+	(void) output;
+}
+
+void feedback_presented(void *data, struct wp_presentation_feedback *feedback,
+			uint32_t tv_sec_hi, uint32_t tv_sec_lo,
+			uint32_t tv_nsec, uint32_t refresh, uint32_t seq_hi,
+			uint32_t seq_lo, uint32_t flags) {
+	(void) data;
+	(void) refresh;
+	(void) seq_hi;
+	(void) seq_lo;
+	(void) flags;
+
+	uint64_t sec = (uint64_t) tv_sec_hi << 32 | tv_sec_lo;
+	bench.present_ns = sec * 1000000000 + tv_nsec;
+	bench.feedback_done = true;
+	bench.frames++;
+	wp_presentation_feedback_destroy(feedback);
+}
+
+void feedback_discarded(void *data,
+			struct wp_presentation_feedback *feedback) {
+	(void) data;
+
+	bench.present_ns = 0;
+	bench.feedback_done = true;
+	wp_presentation_feedback_destroy(feedback);
+}
+
+const struct wp_presentation_feedback_listener feedback_listener = {
+	.sync_output = feedback_sync_output,
+	.presented = feedback_presented,
+	.discarded = feedback_discarded,
+};
+
+void presentation_clock_id(void *data, struct wp_presentation *presentation,
+			   uint32_t clk_id) {
+	(void) data;
+	(void) presentation;
+	bench.clock_id = clk_id;
+}
+
+const struct wp_presentation_listener presentation_listener = {
+	.clock_id = presentation_clock_id,
+};
+
+// dispatch until done() or TIMEOUT_MS
+bool client_wait(bool (*done)(void *data), void *data) {
+	uint64_t deadline = now_ns() + (uint64_t) TIMEOUT_MS * 1000000;
+	while (!done(data)) {
+		while (wl_display_prepare_read(bench.display) != 0) {
+			wl_display_dispatch_pending(bench.display);
+		}
+		wl_display_flush(bench.display);
+
+		uint64_t now = now_ns();
+		int timeout = now < deadline ? (deadline - now) / 1000000 : 0;
+		struct pollfd pfd = {
+			.fd = wl_display_get_fd(bench.display),
+			.events = POLLIN,
+		};
+		if (poll(&pfd, 1, timeout) <= 0) {
+			wl_display_cancel_read(bench.display);
+			return false;
+		}
+		if (wl_display_read_events(bench.display) < 0) {
+			return false;
+		}
+		wl_display_dispatch_pending(bench.display);
+	}
+	return true;
+}
+
+bool feedback_is_done(void *data) {
+	(void) data;
+	return bench.feedback_done;
+}
+
+// commit with presentation feedback and wait for it; the latency is from
+// start_ns to present, 0 if discarded or timed out
+uint64_t surface_commit_present(struct wl_surface *surface,
+				uint64_t start_ns) {
+	struct wp_presentation_feedback *feedback =
+		wp_presentation_feedback(bench.presentation, surface);
+	wp_presentation_feedback_add_listener(feedback, &feedback_listener,
+					      NULL);
+	bench.feedback_done = false;
+	wl_surface_commit(surface);
+
+	if (!client_wait(feedback_is_done, NULL) || bench.present_ns == 0) {
+		return 0;
+	}
+	return bench.present_ns > start_ns ? bench.present_ns - start_ns : 0;
+}
+
+// ack the last configure and attach a buffer of its size, no commit
+void window_draw(struct window *window, uint32_t color) {
+	if (window->serial) {
+		xdg_surface_ack_configure(window->xdg_surface, window->serial);
+		window->serial = 0;
+	}
+	if (window->buffer) {
+		wl_buffer_destroy(window->buffer);
+	}
+	window->buffer =
+		shm_buffer_create(window->width, window->height, color);
+	window->buffer_width = window->width;
+	window->buffer_height = window->height;
+	wl_surface_attach(window->surface, window->buffer, 0, 0);
+	wl_surface_damage_buffer(window->surface, 0, 0, INT32_MAX, INT32_MAX);
+}
+
+bool window_is_configured(void *data) {
+	struct window *window = data;
+	return window->serial != 0;
+}
+
+// configured to a size other than the one drawn
+bool window_is_resized(void *data) {
+	struct window *window = data;
+	return window->serial != 0 &&
+	       (window->width != window->buffer_width ||
+		window->height != window->buffer_height);
+}
+
+void xdg_surface_configure(void *data, struct xdg_surface *xdg_surface,
+			   uint32_t serial) {
+	struct window *window = data;
+	(void) xdg_surface;
+	window->serial = serial;
+}
+
+const struct xdg_surface_listener xdg_surface_listener = {
+	.configure = xdg_surface_configure,
+};
+
+void xdg_toplevel_configure(void *data, struct xdg_toplevel *xdg_toplevel,
+			    int32_t width, int32_t height,
+			    struct wl_array *states) {
+	struct window *window = data;
+	(void) xdg_toplevel;
+	(void) states;
+
+	// 0 leaves the size to us, keep the last one
+	if (width > 0 && height > 0) {
+		window->width = width;
+		window->height = height;
+	}
+}
+
+void xdg_toplevel_close(void *data, struct xdg_toplevel *xdg_toplevel) {
+	(void) data;
+	(void) xdg_toplevel;
+}
+
+const struct xdg_toplevel_listener xdg_toplevel_listener = {
+	.configure = xdg_toplevel_configure,
+	.close = xdg_toplevel_close,
+};
+
+// map and return commit to present of the first buffer, 0 on failure
+uint64_t window_map(struct window *window, int index) {
+	window->width = 640;
+	window->height = 480;
+	window->surface = wl_compositor_create_surface(bench.compositor);
+	window->xdg_surface =
+		xdg_wm_base_get_xdg_surface(bench.wm_base, window->surface);
+	xdg_surface_add_listener(window->xdg_surface, &xdg_surface_listener,
+				 window);
+	window->xdg_toplevel = xdg_surface_get_toplevel(window->xdg_surface);
+	xdg_toplevel_add_listener(window->xdg_toplevel,
+				  &xdg_toplevel_listener, window);
+	xdg_toplevel_set_app_id(window->xdg_toplevel, "wless-bench");
+	wl_surface_commit(window->surface);
+
+	if (!client_wait(window_is_configured, window)) {
+		return 0;
+	}
+	window_draw(window, 0xff000000 | index * 0x101010);
+	return surface_commit_present(window->surface, now_ns());
+}
+
+void window_unmap(struct window *window) {
+	wl_surface_attach(window->surface, NULL, 0, 0);
+	wl_surface_commit(window->surface);
+	xdg_toplevel_destroy(window->xdg_toplevel);
+	xdg_surface_destroy(window->xdg_surface);
+	wl_surface_destroy(window->surface);
+	if (window->buffer) {
+		wl_buffer_destroy(window->buffer);
+	}
+}
+
+void panel_configure(void *data, struct zwlr_layer_surface_v1 *layer_surface,
+		     uint32_t serial, uint32_t width, uint32_t height) {
+	struct panel *panel = data;
+	zwlr_layer_surface_v1_ack_configure(layer_surface, serial);
+	panel->width = width;
+	panel->height = height;
+	panel->configured = true;
+}
+
+void panel_closed(void *data, struct zwlr_layer_surface_v1 *layer_surface) {
+	(void) data;
+	(void) layer_surface;
+}
+
+const struct zwlr_layer_surface_v1_listener panel_listener = {
+	.configure = panel_configure,
+	.closed = panel_closed,
+};
+
+bool panel_is_configured(void *data) {
+	struct panel *panel = data;
+	return panel->configured;
+}
+
+// a top bar without exclusive zone, so mapping it resizes nothing
+bool panel_map(struct panel *panel) {
+	panel->surface = wl_compositor_create_surface(bench.compositor);
+	panel->layer_surface = zwlr_layer_shell_v1_get_layer_surface(
+		bench.layer_shell, panel->surface, NULL,
+		ZWLR_LAYER_SHELL_V1_LAYER_TOP, "wless-bench");
+	zwlr_layer_surface_v1_add_listener(panel->layer_surface,
+					   &panel_listener, panel);
+	uint32_t anchor = ZWLR_LAYER_SURFACE_V1_ANCHOR_TOP |
+			  ZWLR_LAYER_SURFACE_V1_ANCHOR_LEFT |
+			  ZWLR_LAYER_SURFACE_V1_ANCHOR_RIGHT;
+	zwlr_layer_surface_v1_set_anchor(panel->layer_surface, anchor);
+	zwlr_layer_surface_v1_set_size(panel->layer_surface, 0, PANEL_HEIGHT);
+	wl_surface_commit(panel->surface);
+
+	if (!client_wait(panel_is_configured, panel)) {
+		return false;
+	}
+	panel->buffer =
+		shm_buffer_create(panel->width, panel->height, 0xff202020);
+	wl_surface_attach(panel->surface, panel->buffer, 0, 0);
+	wl_surface_commit(panel->surface);
+	return true;
+}
+
+void panel_unmap(struct panel *panel) {
+	zwlr_layer_surface_v1_destroy(panel->layer_surface);
+	wl_surface_destroy(panel->surface);
+	if (panel->buffer) {
+		wl_buffer_destroy(panel->buffer);
+	}
+}
+
+void wm_base_ping(void *data, struct xdg_wm_base *wm_base, uint32_t serial) {
+	(void) data;
+	xdg_wm_base_pong(wm_base, serial);
+}
+
+const struct xdg_wm_base_listener wm_base_listener = {
+	.ping = wm_base_ping,
+};
+
+void registry_global(void *data, struct wl_registry *registry, uint32_t name,
+		     const char *interface, uint32_t version) {
+	(void) data;
+	(void) version;
+
+	if (strcmp(interface, wl_compositor_interface.name) == 0) {
+		bench.compositor = wl_registry_bind(
+			registry, name, &wl_compositor_interface, 4);
+	} else if (strcmp(interface, wl_shm_interface.name) == 0) {
+		bench.shm =
+			wl_registry_bind(registry, name, &wl_shm_interface, 1);
+	} else if (strcmp(interface, xdg_wm_base_interface.name) == 0) {
+		bench.wm_base = wl_registry_bind(registry, name,
+						 &xdg_wm_base_interface, 1);
+		xdg_wm_base_add_listener(bench.wm_base, &wm_base_listener,
+					 NULL);
+	} else if (strcmp(interface, wp_presentation_interface.name) == 0) {
+		bench.presentation = wl_registry_bind(
+			registry, name, &wp_presentation_interface, 1);
+		wp_presentation_add_listener(bench.presentation,
+					     &presentation_listener, NULL);
+	} else if (strcmp(interface, zwlr_layer_shell_v1_interface.name) ==
+		   0) {
+		bench.layer_shell = wl_registry_bind(
+			registry, name, &zwlr_layer_shell_v1_interface, 1);
+	}
+}
+
+void registry_global_remove(void *data, struct wl_registry *registry,
+			    uint32_t name) {
+	(void) data;
+	(void) registry;
+	(void) name;
+}
+
+const struct wl_registry_listener registry_listener = {
+	.global = registry_global,
+	.global_remove = registry_global_remove,
+};
+
+bool client_connect(void) {
+	bench.display = wl_display_connect(NULL);
+	if (!bench.display) {
+		fprintf(stderr, "failed to connect to wless\n");
+		return false;
+	}
+	struct wl_registry *registry = wl_display_get_registry(bench.display);
+	wl_registry_add_listener(registry, &registry_listener, NULL);
+	// globals, then the clock_id of wp_presentation
+	wl_display_roundtrip(bench.display);
+	wl_display_roundtrip(bench.display);
+	if (!bench.compositor || !bench.shm || !bench.wm_base ||
+	    !bench.presentation || !bench.layer_shell) {
+		fprintf(stderr, "missing wl_compositor, wl_shm, xdg_wm_base, "
+				"wp_presentation or zwlr_layer_shell_v1\n");
+		return false;
+	}
+	return true;
+}
+
+void client_report(const char *msg) {
+	if (bench.report_fd < 0) {
+		return;
+	}
+	ssize_t len = write(bench.report_fd, msg, strlen(msg));
+	(void) len;
+}
+
+bool read_line(int fd, char *line, size_t size) {
+	size_t len = 0;
+	while (len + 1 < size) {
+		struct pollfd pfd = {.fd = fd, .events = POLLIN};
+		if (poll(&pfd, 1, TIMEOUT_MS * 10) <= 0) {
+			return false;
+		}
+		if (read(fd, &line[len], 1) != 1) {
+			return false;
+		}
+		if (line[len++] == '\n') {
+			break;
+		}
+	}
+	line[len] = '\0';
+	return true;
+}
+
+// one toplevel per process: write its map latency to sample_fd and keep
+// it mapped, acking configures, until the driver closes quit_fd
+int child_main(int index, int sample_fd, int quit_fd) {
+	if (!client_connect()) {
+		dprintf(sample_fd, "m 0\n");
+		return EXIT_FAILURE;
+	}
+	struct window window = {0};
+	dprintf(sample_fd, "m %" PRIu64 "\n", window_map(&window, index));
+	close(sample_fd);
+
+	struct pollfd pfds[2] = {
+		{.fd = wl_display_get_fd(bench.display), .events = POLLIN},
+		{.fd = quit_fd, .events = POLLIN},
+	};
+	while (true) {
+		wl_display_flush(bench.display);
+		if (poll(pfds, 2, -1) < 0 || pfds[1].revents) {
+			break;
+		}
+		if (pfds[0].revents && wl_display_dispatch(bench.display) < 0) {
+			break;
+		}
+		if (window.serial) {
+			window_draw(&window, 0xff000000 | index * 0x101010);
+			wl_surface_commit(window.surface);
+		}
+	}
+
+	window_unmap(&window);
+	wl_display_roundtrip(bench.display);
+	wl_display_disconnect(bench.display);
+	return EXIT_SUCCESS;
+}
+
+int driver_main(void) {
+	int sample_fds[2], quit_fds[2];
+	if (pipe(sample_fds) < 0 || pipe(quit_fds) < 0) {
+		perror("pipe");
+		return EXIT_FAILURE;
+	}
+
+	struct samples map = {.name = "map"};
+	struct samples resize = {.name = "resize"};
+	pid_t *children = calloc(bench.clients, sizeof(*children));
+	int forked = 0;
+	bool ok = true;
+
+	client_report("s\n");
+	uint64_t start_ns = now_ns();
+
+	// map: each new toplevel becomes the monocle client, one at a time
+	for (; ok && forked < bench.clients - 1; forked++) {
+		pid_t pid = fork();
+		if (pid < 0) {
+			perror("fork");
+			ok = false;
+			break;
+		}
+		if (pid == 0) {
+			close(sample_fds[0]);
+			close(quit_fds[1]);
+			_exit(child_main(forked, sample_fds[1], quit_fds[0]));
+		}
+		children[forked] = pid;
+
+		char line[64];
+		uint64_t ns = 0;
+		ok = read_line(sample_fds[0], line, sizeof(line)) &&
+		     sscanf(line, "m %" SCNu64, &ns) == 1 && ns > 0;
+		if (ok) {
+			samples_add(&map, ns);
+		}
+	}
+	close(sample_fds[0]);
+	close(sample_fds[1]);
+	close(quit_fds[0]);
+	// children are in another process, count their presented frames here
+	uint64_t child_frames = map.len;
+
+	struct window top = {0};
+	struct panel panel = {0};
+	if (ok) {
+		ok = client_connect();
+	}
+	if (ok) {
+		uint64_t ns = window_map(&top, bench.clients - 1);
+		ok = ns > 0;
+		if (ok) {
+			samples_add(&map, ns);
+		}
+	}
+	if (ok) {
+		ok = panel_map(&panel);
+	}
+
+	// resize storm: the exclusive zone flips, wless configures the shown
+	// client to what is left, and it draws at the configured size
+	for (int r = 0; ok && r < bench.rounds; r++) {
+		uint64_t round_ns = now_ns();
+		zwlr_layer_surface_v1_set_exclusive_zone(
+			panel.layer_surface, r % 2 ? 0 : PANEL_HEIGHT);
+		wl_surface_commit(panel.surface);
+		if (!client_wait(window_is_resized, &top)) {
+			ok = false;
+			break;
+		}
+		uint32_t color = (uint32_t) r * 0x0a0b0c & 0xffffff;
+		window_draw(&top, 0xff000000 | color);
+		uint64_t ns = surface_commit_present(top.surface, round_ns);
+		ok = ns > 0;
+		if (ok) {
+			samples_add(&resize, ns);
+		}
+	}
+
+	if (bench.display) {
+		if (panel.surface) {
+			panel_unmap(&panel);
+		}
+		if (top.surface) {
+			window_unmap(&top);
+		}
+		wl_display_roundtrip(bench.display);
+	}
+	// unmap the rest from top to bottom
+	close(quit_fds[1]);
+	for (int i = forked - 1; i >= 0; i--) {
+		waitpid(children[i], NULL, 0);
+	}
+	uint64_t elapsed_ns = now_ns() - start_ns;
+	uint64_t frames = bench.frames + child_frames;
+
+	samples_report(&map);
+	samples_report(&resize);
+	fprintf(stdout, "%-8s %.1f\n", "fps", frames * 1e9 / elapsed_ns);
+	if (!ok) {
+		fprintf(stdout, "timeout after %d frames\n", (int) frames);
+	}
+	fflush(stdout);
+
+	char msg[64];
+	snprintf(msg, sizeof(msg), "e %" PRIu64 "\n", frames);
+	client_report(msg);
+
+	free(map.ns);
+	free(resize.ns);
+	free(children);
+	if (bench.display) {
+		wl_display_disconnect(bench.display);
+	}
+	return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/// parent
+
+// utime + stime in clock ticks
+long long proc_cpu_ticks(pid_t pid) {
+	char path[64], buf[1024];
+	snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+	FILE *fp = fopen(path, "r");
+	if (!fp) {
+		return -1;
+	}
+	size_t len = fread(buf, 1, sizeof(buf) - 1, fp);
+	fclose(fp);
+	buf[len] = '\0';
+
+	// skip "pid (comm) state", comm may contain spaces
+	char *p = strrchr(buf, ')');
+	long long utime = 0, stime = 0;
+	if (!p || sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u "
+				"%lld %lld",
+			 &utime, &stime) != 2) {
+		return -1;
+	}
+	return utime + stime;
+}
+
+int parent_main(const char *wless) {
+	char self[PATH_MAX];
+	ssize_t len = readlink("/proc/self/exe", self, sizeof(self) - 1);
+	if (len < 0) {
+		perror("readlink");
+		return EXIT_FAILURE;
+	}
+	self[len] = '\0';
+
+	int fds[2];
+	if (pipe(fds) < 0) {
+		perror("pipe");
+		return EXIT_FAILURE;
+	}
+
+	char start_cmd[PATH_MAX + 64];
+	snprintf(start_cmd, sizeof(start_cmd), "'%s' -c -f %d -n %d -r %d",
+		 self, fds[1], bench.clients, bench.rounds);
+
+	pid_t pid = fork();
+	if (pid < 0) {
+		perror("fork");
+		return EXIT_FAILURE;
+	}
+	if (pid == 0) {
+		close(fds[0]);
+		setenv("WLR_BACKENDS", "headless", true);
+		setenv("WLR_RENDERER", "pixman", true);
+		setenv("WLR_HEADLESS_OUTPUTS", "1", true);
+		setenv("WLESS_CONFIG", "/dev/null", true);
+		execl(wless, wless, "-s", start_cmd, NULL);
+		perror("execl");
+		_exit(EXIT_FAILURE);
+	}
+	close(fds[1]);
+
+	int ret = EXIT_FAILURE;
+	char line[64];
+	long long cpu_start, cpu_end;
+	uint64_t frames = 0;
+
+	if (!read_line(fds[0], line, sizeof(line)) || line[0] != 's') {
+		fprintf(stderr, "wless or client did not start\n");
+		goto out;
+	}
+	cpu_start = proc_cpu_ticks(pid);
+	if (!read_line(fds[0], line, sizeof(line)) || line[0] != 'e') {
+		fprintf(stderr, "client did not finish\n");
+		goto out;
+	}
+	cpu_end = proc_cpu_ticks(pid);
+	sscanf(line, "e %" SCNu64, &frames);
+
+	if (frames > 0 && cpu_start >= 0 && cpu_end >= 0) {
+		double cpu_ms = (cpu_end - cpu_start) * 1e3 /
+				sysconf(_SC_CLK_TCK);
+		fprintf(stdout, "%-8s %.3fms/frame (%.1fms total)\n", "cpu",
+			cpu_ms / frames, cpu_ms);
+	}
+	ret = EXIT_SUCCESS;
+
+out:
+	kill(pid, SIGTERM);
+	waitpid(pid, NULL, 0);
+	close(fds[0]);
+	return ret;
+}
+
+int main(int argc, char **argv) {
+	const char *wless = NULL;
+	bool is_driver = false;
+
+	int c;
+	while ((c = getopt(argc, argv, "cf:n:r:w:hv")) != -1) {
+		switch (c) {
+		case 'c':
+			is_driver = true;
+			break;
+		case 'f':
+			bench.report_fd = atoi(optarg);
+			break;
+		case 'n':
+			bench.clients = atoi(optarg);
+			break;
+		case 'r':
+			bench.rounds = atoi(optarg);
+			break;
+		case 'w':
+			wless = optarg;
+			break;
+		case 'v':
+			fprintf(stdout, "wless-bench 0.1\n");
+			return EXIT_SUCCESS;
+		case 'h':
+		default:
+			fputs(USAGE, stdout);
+			return c == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+		}
+	}
+	if (bench.clients < 1 || bench.rounds < 0) {
+		fputs(USAGE, stdout);
+		return EXIT_FAILURE;
+	}
+
+	if (is_driver) {
+		return driver_main();
+	}
+	if (!wless) {
+		fputs(USAGE, stdout);
+		return EXIT_FAILURE;
+	}
+	return parent_main(wless);
+}